@@ -0,0 +1,374 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include "config.h"
+#include "utils.h"
+
+#include <cstring>
+
+// -- Default configuration.
+
+static constexpr pool_config DEFAULT_POOL = {
+    ip4(10, 0, 0, 10),      // lease_start
+    ip4(255, 255, 255, 0),  // subnet
+    ip4(10, 0, 0, 1),       // gateway
+    ip4(10, 0, 0, 255),     // broadcast
+    ip4(192, 168, 2, 1),    // dns1
+    8 * 60 * 60,            // lease_time_secs
+    0,                      // lease_time_min_secs
+};
+
+// Dynamic dns updates disabled until 'ddns_server' is configured.
+static constexpr ddns_config DEFAULT_DDNS = {
+    0,                  // server
+    DDNS_DEFAULT_PORT,  // port
+    5 * 60,             // ttl
+    "lan",              // zone
+};
+
+static constexpr server_config DEFAULT_CONFIG = {
+    ip4(10, 0, 0, 2),  // local_ip
+    {DEFAULT_POOL},    // pools
+    1,                 // npools
+    false,             // rapid_commit
+    DEFAULT_DDNS,      // ddns
+    "",                // ssid
+    "",                // wpa2
+};
+
+server_config default_config() {
+    return DEFAULT_CONFIG;
+}
+
+// -- Configuration file.
+
+namespace {
+    // Non owning view into the configuration text.
+    struct str_view {
+        const char* data;
+        usize len;
+
+        bool operator==(const char* other) const {
+            return std::strlen(other) == len && std::memcmp(data, other, len) == 0;
+        }
+    };
+}  // namespace
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static str_view trim(str_view s) {
+    while (s.len && is_space(s.data[0])) {
+        ++s.data;
+        --s.len;
+    }
+    while (s.len && is_space(s.data[s.len - 1])) {
+        --s.len;
+    }
+    return s;
+}
+
+static std::optional<u32> parse_u32(str_view s) {
+    if (s.len == 0 || s.len > 10) {
+        return std::nullopt;
+    }
+
+    u64 val = 0;
+    for (usize i = 0; i < s.len; ++i) {
+        if (s.data[i] < '0' || s.data[i] > '9') {
+            return std::nullopt;
+        }
+        val = val * 10 + (s.data[i] - '0');
+    }
+
+    if (val > 0xffffffff) {
+        return std::nullopt;
+    }
+    return static_cast<u32>(val);
+}
+
+template<usize N>
+static bool parse_str(str_view s, char (&out)[N]) {
+    if (s.len >= N) {
+        return false;
+    }
+    std::memcpy(out, s.data, s.len);
+    out[s.len] = '\0';
+    return true;
+}
+
+// Check that 's' is a dns name of labels with letters, digits and hyphens,
+// an optional trailing dot is stripped.
+static std::optional<str_view> parse_zone(str_view s) {
+    if (s.len && s.data[s.len - 1] == '.') {
+        --s.len;
+    }
+    if (s.len == 0) {
+        return std::nullopt;
+    }
+
+    usize label = 0;
+    for (usize i = 0; i <= s.len; ++i) {
+        if (i == s.len || s.data[i] == '.') {
+            if (label == 0 || label > 63) {
+                return std::nullopt;
+            }
+            label = 0;
+        } else if ((s.data[i] >= 'a' && s.data[i] <= 'z') || (s.data[i] >= 'A' && s.data[i] <= 'Z') ||
+                   (s.data[i] >= '0' && s.data[i] <= '9') || s.data[i] == '-') {
+            ++label;
+        } else {
+            return std::nullopt;
+        }
+    }
+    return s;
+}
+
+std::optional<u32> parse_ip4(const char* str, usize len) {
+    u32 addr = 0;
+    u32 octet = 0;
+    usize digits = 0;
+    usize octets = 0;
+
+    for (usize i = 0; i <= len; ++i) {
+        if (i == len || str[i] == '.') {
+            // End of octet.
+            if (digits == 0 || octet > 255 || ++octets > 4) {
+                return std::nullopt;
+            }
+            addr = (addr << 8) | octet;
+            octet = 0;
+            digits = 0;
+        } else if (str[i] >= '0' && str[i] <= '9' && digits < 3) {
+            octet = octet * 10 + (str[i] - '0');
+            ++digits;
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    if (octets != 4) {
+        return std::nullopt;
+    }
+    return addr;
+}
+
+// Parse a single pool 'key = value' pair into 'pool'.
+//
+// Return nullopt if 'key' is not a pool key.
+static std::optional<bool> parse_pool_pair(str_view key, str_view val, pool_config& pool) {
+    struct {
+        const char* key;
+        u32 pool_config::*field;
+    } addrs[] = {
+        {"lease_start", &pool_config::lease_start},
+        {"subnet", &pool_config::subnet},
+        {"gateway", &pool_config::gateway},
+        {"broadcast", &pool_config::broadcast},
+        {"dns1", &pool_config::dns1},
+    };
+
+    for (const auto& a : addrs) {
+        if (key == a.key) {
+            const auto addr = parse_ip4(val.data, val.len);
+            if (!addr) {
+                return false;
+            }
+            pool.*a.field = addr.value();
+            return true;
+        }
+    }
+
+    if (key == "lease_time") {
+        const auto secs = parse_u32(val);
+        if (!secs || secs.value() == 0 || secs.value() > CONFIG_MAX_LEASE_TIME_SECS) {
+            return false;
+        }
+        pool.lease_time_secs = secs.value();
+        return true;
+    }
+
+    if (key == "lease_time_min") {
+        const auto secs = parse_u32(val);
+        if (!secs) {
+            return false;
+        }
+        pool.lease_time_min_secs = secs.value();
+        return true;
+    }
+
+    return std::nullopt;
+}
+
+// Parse a single server 'key = value' pair into 'cfg'.
+static bool parse_pair(str_view key, str_view val, server_config& cfg) {
+    if (key == "local_ip") {
+        const auto addr = parse_ip4(val.data, val.len);
+        if (!addr) {
+            return false;
+        }
+        cfg.local_ip = addr.value();
+        return true;
+    } else if (key == "rapid_commit") {
+        if (val == "1") {
+            cfg.rapid_commit = true;
+        } else if (val == "0") {
+            cfg.rapid_commit = false;
+        } else {
+            return false;
+        }
+        return true;
+    } else if (key == "ddns_server") {
+        const auto addr = parse_ip4(val.data, val.len);
+        if (!addr) {
+            return false;
+        }
+        cfg.ddns.server = addr.value();
+        return true;
+    } else if (key == "ddns_port") {
+        const auto port = parse_u32(val);
+        if (!port || port.value() == 0 || port.value() > 0xffff) {
+            return false;
+        }
+        cfg.ddns.port = static_cast<u16>(port.value());
+        return true;
+    } else if (key == "ddns_ttl") {
+        const auto ttl = parse_u32(val);
+        if (!ttl) {
+            return false;
+        }
+        cfg.ddns.ttl = ttl.value();
+        return true;
+    } else if (key == "ddns_zone") {
+        const auto zone = parse_zone(val);
+        return zone && parse_str(zone.value(), cfg.ddns.zone);
+    } else if (key == "ssid") {
+        return parse_str(val, cfg.ssid);
+    } else if (key == "wpa2") {
+        return parse_str(val, cfg.wpa2);
+    }
+
+    // Unknown key.
+    return false;
+}
+
+std::optional<server_config> parse_config(const char* text, usize len, const server_config& base, usize* err_line) {
+    server_config cfg = base;
+
+    // Line number of the pool sections, to report invalid pools.
+    std::array<usize, CONFIG_MAX_POOLS> pool_line = {};
+    bool in_section = false;
+
+    const char* end = text + len;
+    usize line_nr = 0;
+
+    const auto error = [&](usize line) -> std::optional<server_config> {
+        if (err_line) {
+            *err_line = line;
+        }
+        return std::nullopt;
+    };
+
+    while (text < end) {
+        const char* eol = static_cast<const char*>(std::memchr(text, '\n', end - text));
+        if (!eol) {
+            eol = end;
+        }
+
+        ++line_nr;
+        const str_view line = trim({text, static_cast<usize>(eol - text)});
+        text = eol + 1;
+
+        // Skip empty lines and comments.
+        if (line.len == 0 || line.data[0] == '#') {
+            continue;
+        }
+
+        // Start of a new relay pool, defaults to the local pool.
+        if (line == "[pool]") {
+            if (!in_section) {
+                // First section drops the relay pools from 'base'.
+                cfg.npools = 1;
+                in_section = true;
+            }
+            if (cfg.npools == CONFIG_MAX_POOLS) {
+                return error(line_nr);
+            }
+
+            pool_config& pool = cfg.pools[cfg.npools];
+            pool = cfg.pools[0];
+            pool.lease_start = 0;
+            pool.gateway = 0;
+            pool.broadcast = 0;
+            pool_line[cfg.npools++] = line_nr;
+            continue;
+        }
+
+        const char* eq = static_cast<const char*>(std::memchr(line.data, '=', line.len));
+        if (!eq) {
+            return error(line_nr);
+        }
+        const str_view key = trim({line.data, static_cast<usize>(eq - line.data)});
+        const str_view val = trim({eq + 1, static_cast<usize>(line.data + line.len - eq - 1)});
+
+        // Keys before the first section belong to the server and the local pool.
+        pool_config& pool = in_section ? cfg.pools[cfg.npools - 1] : cfg.pools[0];
+
+        if (const auto ok = parse_pool_pair(key, val, pool)) {
+            if (!ok.value()) {
+                return error(line_nr);
+            }
+        } else if (in_section || !parse_pair(key, val, cfg)) {
+            return error(line_nr);
+        }
+    }
+
+    if (cfg.pools[0].lease_time_min_secs > cfg.pools[0].lease_time_secs) {
+        return error(line_nr);
+    }
+
+    // Validate relay pools and derive missing values.
+    for (usize p = 1; p < cfg.npools; ++p) {
+        pool_config& pool = cfg.pools[p];
+        if (pool.lease_start == 0 || pool.gateway == 0 || pool.lease_time_min_secs > pool.lease_time_secs) {
+            return error(pool_line[p]);
+        }
+        if (pool.broadcast == 0) {
+            pool.broadcast = network_range(pool).last;
+        }
+    }
+
+    // Pool networks must not overlap, else relay agents can't be mapped to pools.
+    std::array<pool_range, CONFIG_MAX_POOLS> ranges;
+    for (usize p = 0; p < cfg.npools; ++p) {
+        ranges[p] = network_range(cfg.pools[p]);
+    }
+    if (!pool_index<CONFIG_MAX_POOLS>().build(ranges.data(), cfg.npools)) {
+        return error(cfg.npools > 1 ? pool_line[cfg.npools - 1] : line_nr);
+    }
+
+    return cfg;
+}
+
+std::optional<usize> find_invalid_pool(const server_config& cfg, usize leases) {
+    for (usize p = 0; p < cfg.npools; ++p) {
+        const pool_config& pool = cfg.pools[p];
+        const pool_range net = network_range(pool);
+
+        // Exclude the network and the broadcast address of the network.
+        const u64 first = pool.lease_start;
+        const u64 last = first + leases - 1;
+        if (leases == 0 || first <= net.first || last >= net.last) {
+            return p;
+        }
+
+        for (const u32 addr : {pool.gateway, pool.broadcast, cfg.local_ip}) {
+            if (addr >= first && addr <= last) {
+                return p;
+            }
+        }
+    }
+    return std::nullopt;
+}
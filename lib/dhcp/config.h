@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "pool_index.h"
+#include "types.h"
+
+#include <array>
+#include <optional>
+
+// Max number of address pools, including the pool of the local network.
+#ifndef DHCP_MAX_POOLS
+#    define DHCP_MAX_POOLS 8
+#endif
+
+constexpr usize CONFIG_MAX_POOLS = DHCP_MAX_POOLS;
+
+static_assert(CONFIG_MAX_POOLS > 0, "Need at least the pool of the local network.");
+
+// Default port of the dns server accepting dynamic updates.
+constexpr u16 DDNS_DEFAULT_PORT = 53;
+
+// Max lease time, keeps the computation of the derived renewal and rebinding
+// times and of the absolute lease end times in range.
+constexpr u32 CONFIG_MAX_LEASE_TIME_SECS = 365 * 24 * 3600;
+
+// Address pool configuration.
+//
+// All addresses are in host byte order, see 'ip4()'.
+struct pool_config {
+    // First address of the dhcp address range.
+    u32 lease_start;
+    u32 subnet;
+    u32 gateway;
+    u32 broadcast;
+    u32 dns1;
+    u32 lease_time_secs;
+    // Lease time granted when the pool is nearly full, 0 to always grant
+    // 'lease_time_secs' (see 'adaptive_lease_time()').
+    u32 lease_time_min_secs;
+};
+
+// Get the network address range of 'pool', used to select the pool of a
+// relay agent by its address.
+constexpr pool_range network_range(const pool_config& pool) {
+    return {pool.lease_start & pool.subnet, pool.lease_start | ~pool.subnet};
+}
+
+// Dynamic dns update (rfc2136) configuration, see 'ddns_batcher'.
+//
+// Leases of clients sending a host name get an A record '<host>.<zone>' on the
+// dns server 'server':'port'. Updates are disabled if 'server' is 0.
+struct ddns_config {
+    u32 server;
+    u16 port;
+    // TTL of the A records.
+    u32 ttl;
+    // Forward zone, eg "lan" or "home.arpa".
+    char zone[64];
+};
+
+// Server configuration.
+//
+// 'pools[0]' is the pool of the local network which serves clients without
+// relay agent, 'pools[1..npools)' are served through relay agents (giaddr).
+//
+// All addresses are in host byte order, see 'ip4()'.
+struct server_config {
+    u32 local_ip;
+
+    std::array<pool_config, CONFIG_MAX_POOLS> pools;
+    usize npools;
+
+    // Commit leases on DHCP_DISCOVER with the Rapid Commit option (rfc4039).
+    bool rapid_commit;
+
+    // Dynamic dns updates for bound leases.
+    ddns_config ddns;
+
+    // Wifi access configuration (only used by the embedded target).
+    char ssid[33];
+    char wpa2[64];
+};
+
+// Get the default configuration, used by the embedded target and the host
+// tools unless overridden by a configuration file (see 'parse_config').
+//
+// The server is 10.0.0.2 on the local network 10.0.0.0/24 with the gateway
+// 10.0.0.1 and hands out leases from 10.0.0.10 for 8h. Adaptive lease times
+// and dynamic dns updates are disabled, the wifi access configuration is
+// empty.
+server_config default_config();
+
+// Parse the configuration file 'text' of length 'len'.
+//
+// The file consists of 'key = value' lines, empty lines and lines starting
+// with '#' are ignored. Keys not set in the file keep the value from 'base'.
+//
+// Keys at the top of the file configure the server and the pool of the local
+// network. Each '[pool]' section adds a pool served through a relay agent,
+// pool keys not set in a section default to the local pool, except
+// 'lease_start', 'gateway' and 'broadcast' which must be set or are derived.
+//
+//   local_ip       = 10.0.0.2
+//   gateway        = 10.0.0.1
+//   broadcast      = 10.0.0.255
+//   subnet         = 255.255.255.0
+//   dns1           = 192.168.2.1
+//   lease_start    = 10.0.0.10
+//   lease_time     = 28800
+//   lease_time_min = 900
+//   rapid_commit   = 0
+//   ddns_server    = 10.0.0.3
+//   ddns_port      = 53
+//   ddns_ttl       = 300
+//   ddns_zone      = lan
+//   ssid           = <SSID>
+//   wpa2           = <WPA2PW>
+//
+//   [pool]
+//   lease_start    = 10.1.0.10
+//   gateway        = 10.1.0.1
+//
+// Return nullopt if the file contains unknown keys, malformed values, a
+// 'lease_time' above CONFIG_MAX_LEASE_TIME_SECS, a 'lease_time_min' above the
+// 'lease_time' of its pool, a 'ddns_zone' which is not a valid dns name or
+// overlapping pools, in that case 'err_line' (if not null) is set to the
+// offending line number.
+//
+// The number of leases is a property of the server, hence the lease ranges
+// are checked separately, see 'find_invalid_pool'.
+std::optional<server_config> parse_config(const char* text, usize len, const server_config& base, usize* err_line = nullptr);
+
+// Check the lease range of each pool of 'cfg' for a server with 'leases'
+// leases per pool. The range '[lease_start, lease_start + leases)' must only
+// contain host addresses of the pool network and must not contain the
+// gateway, the broadcast address or 'local_ip'.
+//
+// Return the index of the first invalid pool, nullopt if all pools are valid.
+std::optional<usize> find_invalid_pool(const server_config& cfg, usize leases);
+
+// Parse a dotted ipv4 address into host byte order.
+std::optional<u32> parse_ip4(const char* str, usize len);
+
+#endif
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include "ddns.h"
+#include "dhcp.h"
+
+// -- dns message constants (rfc1035 4.1, rfc2136 2.).
+
+static constexpr usize DNS_HEADER_LEN = 12;
+static constexpr u16 DNS_OPCODE_UPDATE = 5;
+
+static constexpr u16 DNS_TYPE_A = 1;
+static constexpr u16 DNS_TYPE_SOA = 6;
+
+static constexpr u16 DNS_CLASS_IN = 1;
+static constexpr u16 DNS_CLASS_NONE = 254;
+static constexpr u16 DNS_CLASS_ANY = 255;
+
+// Compression pointer to the zone name, which directly follows the header.
+static constexpr u16 DNS_ZONE_PTR = 0xc000 | DNS_HEADER_LEN;
+
+usize ddns_label(const char* hostname, char (&label)[LEASE_EVENT_HOSTNAME_LEN + 1]) {
+    usize len = 0;
+    for (const char* c = hostname; *c != '\0' && *c != '.' && len < LEASE_EVENT_HOSTNAME_LEN; ++c) {
+        if (*c >= 'A' && *c <= 'Z') {
+            label[len++] = *c - 'A' + 'a';
+        } else if ((*c >= 'a' && *c <= 'z') || (*c >= '0' && *c <= '9')) {
+            label[len++] = *c;
+        } else {
+            label[len++] = '-';
+        }
+    }
+
+    // Labels must not start or end with a hyphen.
+    usize start = 0;
+    while (start < len && label[start] == '-') {
+        ++start;
+    }
+    while (len > start && label[len - 1] == '-') {
+        --len;
+    }
+
+    len -= start;
+    std::memmove(label, label + start, len);
+    label[len] = '\0';
+    return len;
+}
+
+ddns_message::ddns_message(u8* buf, usize len, u16 id, const char* zone) : buf(buf), cap(len), pos(0), count(0) {
+    // Header, zone and prerequisite count are fixed, the update count is
+    // written with each update.
+    const usize zone_len = std::strlen(zone);
+    if (zone_len == 0 || DNS_HEADER_LEN + zone_len + 2 + 4 > cap) {
+        return;
+    }
+
+    u8* p = buf;
+    p = put_opt_val<u16>(p, id);
+    p = put_opt_val<u16>(p, DNS_OPCODE_UPDATE << 11);
+    p = put_opt_val<u16>(p, 1 /* ZOCOUNT */);
+    p = put_opt_val<u16>(p, 0 /* PRCOUNT */);
+    p = put_opt_val<u16>(p, 0 /* UPCOUNT */);
+    p = put_opt_val<u16>(p, 0 /* ADCOUNT */);
+
+    // Zone name as sequence of length prefixed labels.
+    const char* label = zone;
+    for (;;) {
+        const char* dot = std::strchr(label, '.');
+        const usize len = dot ? dot - label : std::strlen(label);
+        *p++ = len;
+        std::memcpy(p, label, len);
+        p += len;
+        if (!dot) {
+            break;
+        }
+        label = dot + 1;
+    }
+    *p++ = 0;
+
+    p = put_opt_val<u16>(p, DNS_TYPE_SOA);
+    p = put_opt_val<u16>(p, DNS_CLASS_IN);
+    pos = p - buf;
+}
+
+bool ddns_message::delete_a(const char* label) {
+    return append_rr(label, DNS_CLASS_ANY, 0 /* ttl */, nullptr, 0);
+}
+
+bool ddns_message::remove_a(const char* label, u32 addr) {
+    u8 rdata[4];
+    put_opt_val(rdata, addr);
+    return append_rr(label, DNS_CLASS_NONE, 0 /* ttl */, rdata, sizeof(rdata));
+}
+
+bool ddns_message::add_a(const char* label, u32 addr, u32 ttl) {
+    u8 rdata[4];
+    put_opt_val(rdata, addr);
+    return append_rr(label, DNS_CLASS_IN, ttl, rdata, sizeof(rdata));
+}
+
+void ddns_message::restore(mark m) {
+    if (pos == 0) {
+        return;
+    }
+    pos = m.len;
+    count = m.updates;
+    put_opt_val<u16>(buf + 8, count);
+}
+
+bool ddns_message::append_rr(const char* label, u16 cls, u32 ttl, const u8* rdata, u16 rdlen) {
+    const usize label_len = std::strlen(label);
+    if (pos == 0 || label_len == 0 || label_len > 63 || pos + 1 + label_len + 2 + 10 + rdlen > cap) {
+        return false;
+    }
+
+    u8* p = buf + pos;
+    *p++ = label_len;
+    std::memcpy(p, label, label_len);
+    p += label_len;
+    p = put_opt_val<u16>(p, DNS_ZONE_PTR);
+
+    p = put_opt_val<u16>(p, DNS_TYPE_A);
+    p = put_opt_val<u16>(p, cls);
+    p = put_opt_val(p, ttl);
+    p = put_opt_val<u16>(p, rdlen);
+    if (rdlen) {
+        std::memcpy(p, rdata, rdlen);
+        p += rdlen;
+    }
+
+    pos = p - buf;
+    put_opt_val<u16>(buf + 8, ++count);
+    return true;
+}
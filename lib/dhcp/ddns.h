@@ -0,0 +1,312 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+//
+// Dynamic updates in the domain name system: https://datatracker.ietf.org/doc/html/rfc2136
+
+#ifndef DDNS_H
+#define DDNS_H
+
+#include "config.h"
+#include "lease_events.h"
+#include "types.h"
+
+#include <array>
+#include <cstring>
+
+// -- Global constants.
+
+// Max length of an update message, the dns message limit over udp without
+// EDNS (rfc1035 2.3.4).
+constexpr usize DDNS_MESSAGE_LEN = 512;
+
+// Time a change is held back to be batched with following changes.
+constexpr usize DDNS_BATCH_DELAY_SECS = 2;
+
+// -- Update message.
+
+// Convert the client host name 'hostname' into a dns label: the first label
+// of the name in lower case, characters other than letters, digits and hyphens
+// are replaced by hyphens.
+//
+// Return the length of the label, 0 if the host name gives no usable label.
+usize ddns_label(const char* hostname, char (&label)[LEASE_EVENT_HOSTNAME_LEN + 1]);
+
+// Writer of a dns UPDATE message (rfc2136 2.) of the zone 'zone' into 'buf'.
+//
+// The zone is written once into the zone section, owner names of the updates
+// are '<label>.<zone>' with the zone compressed (rfc1035 4.1.4).
+class ddns_message {
+  public:
+    // 'zone' must be a valid dns name (see 'parse_config').
+    ddns_message(u8* buf, usize len, u16 id, const char* zone);
+
+    // Append the deletion of all A records of '<label>.<zone>' (rfc2136 2.5.2).
+    //
+    // Return false if the message is full, the message is unchanged.
+    bool delete_a(const char* label);
+
+    // Append the deletion of the A record '<label>.<zone>' -> 'addr' (rfc2136
+    // 2.5.4).
+    //
+    // Return false if the message is full, the message is unchanged.
+    bool remove_a(const char* label, u32 addr);
+
+    // Append the A record '<label>.<zone>' -> 'addr' (rfc2136 2.5.1).
+    //
+    // Return false if the message is full, the message is unchanged.
+    bool add_a(const char* label, u32 addr, u32 ttl);
+
+    // Position in the message, to drop updates appended after 'save()'.
+    struct mark {
+        usize len;
+        u16 updates;
+    };
+
+    mark save() const {
+        return {pos, count};
+    }
+
+    void restore(mark m);
+
+    // Get the length of the message, 0 if the zone didn't fit.
+    usize len() const {
+        return pos;
+    }
+
+    // Get the number of updates in the message.
+    u16 updates() const {
+        return count;
+    }
+
+  private:
+    bool append_rr(const char* label, u16 cls, u32 ttl, const u8* rdata, u16 rdlen);
+
+    u8* buf;
+    usize cap;
+    usize pos;
+    u16 count;
+};
+
+// -- Update batching.
+
+// Coalesce lease events into batched dns updates for the A records of client
+// host names.
+//
+// The batcher tracks the name published for up to 'SLOTS' addresses. Events
+// only set the desired name of an address, a change is pending as long as it
+// differs from the published name. Renewals without a new name are no change,
+// hence renew storms don't cause any updates.
+//
+// Pending changes are held back for DDNS_BATCH_DELAY_SECS and then sent
+// together, as few UPDATE messages as fit the changes. Updates are best
+// effort, responses of the dns server are not evaluated.
+template<usize SLOTS>
+class ddns_batcher {
+  public:
+    constexpr ddns_batcher() = default;
+
+    ddns_batcher(const ddns_batcher&) = delete;
+    ddns_batcher& operator=(const ddns_batcher&) = delete;
+
+    // Apply the lease event 'ev' received at 'now_secs' (absolute time value
+    // in seconds).
+    //
+    // Return false if the address of 'ev' can't be tracked because all slots
+    // are in use, the event is dropped.
+    bool add(const lease_event& ev, usize now_secs);
+
+    // Get the number of addresses with a pending change.
+    usize pending() const {
+        return changes;
+    }
+
+    // Encode pending changes into 'buf' of length 'len' if the batch is due,
+    // or right away if 'force' is set. The changes are considered published.
+    //
+    // Return the message length, 0 if no message is due. If not all changes
+    // fit into one message, the next call returns the following message.
+    usize flush(u8* buf, usize len, const ddns_config& cfg, usize now_secs, bool force = false);
+
+    // Apply all events queued in 'ring' and send due messages with
+    // 'send(const u8* msg, usize len)' to the endpoint of 'cfg'.
+    //
+    // If updates are disabled in 'cfg' the events are discarded.
+    //
+    // Return the number of messages sent.
+    template<usize RING, typename S>
+    usize drain(event_ring<RING>& ring, const ddns_config& cfg, usize now_secs, S send);
+
+    // Get the number of events dropped by 'drain' because all slots were in
+    // use.
+    u32 dropped() const {
+        return drops;
+    }
+
+  private:
+    // Tracked address, the slot is free if 'addr' is 0. An empty name means
+    // no record.
+    struct entry {
+        u32 addr;
+        // Desired name.
+        char name[LEASE_EVENT_HOSTNAME_LEN + 1];
+        // Name of the record sent to the dns server.
+        char published[LEASE_EVENT_HOSTNAME_LEN + 1];
+    };
+
+    static bool dirty(const entry& e) {
+        return e.addr != 0 && std::strcmp(e.name, e.published) != 0;
+    }
+
+    entry* find(u32 addr) {
+        for (entry& e : entries) {
+            if (e.addr == addr) {
+                return &e;
+            }
+        }
+        return nullptr;
+    }
+
+    template<typename S>
+    usize send_due(const ddns_config& cfg, usize now_secs, bool force, S& send) {
+        usize sent = 0;
+        while (const usize len = flush(msg.data(), msg.size(), cfg, now_secs, force)) {
+            send(msg.data(), len);
+            ++sent;
+        }
+        return sent;
+    }
+
+    std::array<entry, SLOTS> entries = {};
+    // Number of dirty entries.
+    usize changes = 0;
+    // Time the oldest pending change was added.
+    usize batch_start = 0;
+    u16 next_id = 1;
+    u32 drops = 0;
+    std::array<u8, DDNS_MESSAGE_LEN> msg = {};
+};
+
+template<usize SLOTS>
+bool ddns_batcher<SLOTS>::add(const lease_event& ev, usize now_secs) {
+    char label[LEASE_EVENT_HOSTNAME_LEN + 1];
+    ddns_label(ev.hostname, label);
+
+    if (ev.addr == 0) {
+        return true;
+    }
+
+    entry* e = find(ev.addr);
+    const bool was_dirty = e && dirty(*e);
+
+    switch (ev.type) {
+        case lease_event_type::EXPIRE:
+            if (!e) {
+                return true;
+            }
+            e->name[0] = '\0';
+            break;
+
+        case lease_event_type::RENEW:
+            // Clients don't always repeat their name on renewal, keep it.
+            if (label[0] == '\0') {
+                return true;
+            }
+            [[fallthrough]];
+
+        case lease_event_type::NEW:
+            if (!e && label[0] == '\0') {
+                return true;
+            }
+            if (!e) {
+                e = find(0);
+                if (!e) {
+                    return false;
+                }
+                e->addr = ev.addr;
+            }
+            std::memcpy(e->name, label, sizeof(label));
+            break;
+    }
+
+    // Release the slot once the address has no record and no pending change.
+    if (e->name[0] == '\0' && e->published[0] == '\0') {
+        *e = {};
+    }
+
+    const bool is_dirty = dirty(*e);
+    if (!was_dirty && is_dirty) {
+        if (changes++ == 0) {
+            batch_start = now_secs;
+        }
+    } else if (was_dirty && !is_dirty) {
+        --changes;
+    }
+    return true;
+}
+
+template<usize SLOTS>
+usize ddns_batcher<SLOTS>::flush(u8* buf, usize len, const ddns_config& cfg, usize now_secs, bool force) {
+    if (changes == 0 || (!force && now_secs < batch_start + DDNS_BATCH_DELAY_SECS)) {
+        return 0;
+    }
+
+    ddns_message m(buf, len, next_id, cfg.zone);
+
+    for (entry& e : entries) {
+        if (!dirty(e)) {
+            continue;
+        }
+
+        // Remove the old record of the address, other clients may use the same
+        // name. Replace all A records of the new name, which may be stale from
+        // a previous lease (eg lost on reboot), the last client wins.
+        const auto mark = m.save();
+        const bool ok = (e.published[0] == '\0' || m.remove_a(e.published, e.addr)) &&
+                        (e.name[0] == '\0' || (m.delete_a(e.name) && m.add_a(e.name, e.addr, cfg.ttl)));
+        if (!ok) {
+            m.restore(mark);
+            break;
+        }
+
+        std::memcpy(e.published, e.name, sizeof(e.name));
+        if (e.name[0] == '\0') {
+            e = {};
+        }
+        --changes;
+    }
+
+    if (m.updates() == 0) {
+        return 0;
+    }
+    ++next_id;
+    return m.len();
+}
+
+template<usize SLOTS>
+template<usize RING, typename S>
+usize ddns_batcher<SLOTS>::drain(event_ring<RING>& ring, const ddns_config& cfg, usize now_secs, S send) {
+    const bool enabled = cfg.server != 0 && cfg.zone[0] != '\0';
+
+    usize sent = 0;
+    while (const auto ev = ring.pop()) {
+        if (!enabled) {
+            continue;
+        }
+        // Out of slots, send pending changes right away which frees the slots
+        // of deleted records and retry.
+        if (!add(ev.value(), now_secs)) {
+            sent += send_due(cfg, now_secs, true /* force */, send);
+            if (!add(ev.value(), now_secs)) {
+                ++drops;
+            }
+        }
+    }
+
+    if (enabled) {
+        sent += send_due(cfg, now_secs, false /* force */, send);
+    }
+    return sent;
+}
+
+#endif
@@ -35,6 +35,7 @@ enum class dhcp_option : u8 {
     SUBNET_MASK = 1,
     ROUTER = 3,
     DNS = 6,
+    HOST_NAME = 12,
 
     // IP Layer Parameters per Interface.
     BROADCAST_ADDR = 28,
@@ -52,6 +53,9 @@ enum class dhcp_option : u8 {
     REBINDING_TIME_T2,
     CLASS_ID,
     CLIENT_ID,
+
+    // Rapid Commit (rfc4039).
+    RAPID_COMMIT = 80,
 };
 
 // -- DHCP message.
@@ -8,17 +8,26 @@
 #include "types.h"
 
 #include <array>
+#include <utility>
 #include <optional>
 
+// The client is identified by a 64 bit keyed fingerprint of its identifier
+// (see 'hash64'), wide enough to make accidental collisions between clients
+// negligible even for large fleets.
+//
+// A lease is 'bound' once it was acknowledged to the client, before that it is
+// only reserved for an offer.
 struct lease {
-    u32 client_hash;
+    u64 client_hash;
     usize lease_end;
+    bool bound;
 };
 
 // Lease database, for managing client leases, which includes
 //   - allocation of new leases
 //   - lookup of existing leases
 //   - update of existing leases
+//   - binding of offered leases
 //   - flushing of expired leases
 //
 // The database supports 'LEASE' number of clients.
@@ -47,7 +56,7 @@ class lease_db {
     // return nullopt.
     //
     // 'lease_end' sets the expiration time of the lease (should be absolute time).
-    std::optional<usize> new_lease(u32 client_hash, usize lease_end) {
+    std::optional<usize> new_lease(u64 client_hash, usize lease_end) {
         if (get_lease(client_hash)) {
             return std::nullopt;
         }
@@ -56,6 +65,7 @@ class lease_db {
             if (leases[l].client_hash == 0) {
                 leases[l].client_hash = client_hash;
                 leases[l].lease_end = lease_end;
+                leases[l].bound = false;
                 return l;
             }
         }
@@ -63,7 +73,7 @@ class lease_db {
     }
 
     // Try to get the lease for the client if it exists.
-    std::optional<usize> get_lease(u32 client_hash) const {
+    std::optional<usize> get_lease(u64 client_hash) const {
         for (usize l = 0; client_hash != 0 && l < LEASES; ++l) {
             if (leases[l].client_hash == client_hash) {
                 return l;
@@ -74,7 +84,7 @@ class lease_db {
 
     // Update expiration time for client if the client has an allocated lease.
     // Similar to 'new_lease' the 'lease_end' should be an absolute time value.
-    bool update_lease(u32 client_hash, usize lease_end) {
+    bool update_lease(u64 client_hash, usize lease_end) {
         for (usize l = 0; client_hash != 0 && l < LEASES; ++l) {
             if (leases[l].client_hash == client_hash) {
                 leases[l].lease_end = lease_end;
@@ -84,17 +94,104 @@ class lease_db {
         return false;
     }
 
+    // Bind the lease of the client (acknowledged to the client) and update its
+    // expiration time, 'lease_end' should be an absolute time value.
+    //
+    // Return whether the lease was already bound before (renewal), or nullopt
+    // if the client has no allocated lease.
+    std::optional<bool> bind_lease(u64 client_hash, usize lease_end) {
+        for (usize l = 0; client_hash != 0 && l < LEASES; ++l) {
+            if (leases[l].client_hash == client_hash) {
+                const bool renew = leases[l].bound;
+                leases[l].lease_end = lease_end;
+                leases[l].bound = true;
+                return renew;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Get the expiration time of the lease 'idx' (absolute time value).
+    usize lease_end(usize idx) const {
+        return idx < LEASES ? leases[idx].lease_end : 0;
+    }
+
     // Check for expired leases and free them accordingly.
     // 'curr_time' should be the current time as absolute time value.
     void flush_expired(usize curr_time) {
-        for (lease& l : leases) {
-            if (l.lease_end <= curr_time) {
-                l.client_hash = 0;
-                l.lease_end = 0;
+        flush_expired(curr_time, [](usize, const lease&) {});
+    }
+
+    // Same as 'flush_expired' but call 'on_expired(usize idx, const lease& l)'
+    // for each allocated lease before it is freed.
+    template<typename F>
+    void flush_expired(usize curr_time, F on_expired) {
+        for (usize l = 0; l < LEASES; ++l) {
+            if (leases[l].lease_end <= curr_time) {
+                if (leases[l].client_hash != 0) {
+                    on_expired(l, leases[l]);
+                }
+                leases[l] = {};
             }
         }
     }
 
+    // Move the leases by 'delta' positions, such that a client keeps its
+    // address when the start address of the dhcp address range moves by
+    // 'delta' (new_start = old_start + delta).
+    //
+    // Leases which fall out of the range are freed.
+    void rebase(long delta) {
+        rebase(delta, [](usize, const lease&) {});
+    }
+
+    // Same as 'rebase' but call 'on_dropped(usize idx, const lease& l)' for
+    // each lease which is freed, 'idx' is the position before the move.
+    template<typename F>
+    void rebase(long delta, F on_dropped) {
+        std::array<lease, LEASES> old = leases;
+        leases = {};
+
+        for (usize l = 0; l < LEASES; ++l) {
+            if (old[l].client_hash == 0) {
+                continue;
+            }
+            const long idx = static_cast<long>(l) - delta;
+            if (idx >= 0 && idx < static_cast<long>(LEASES)) {
+                leases[idx] = old[l];
+            } else {
+                on_dropped(l, old[l]);
+            }
+        }
+    }
+
+    // Free all leases.
+    void clear() {
+        clear([](usize, const lease&) {});
+    }
+
+    // Same as 'clear' but call 'on_dropped(usize idx, const lease& l)' for each
+    // allocated lease before it is freed.
+    template<typename F>
+    void clear(F on_dropped) {
+        for (usize l = 0; l < LEASES; ++l) {
+            if (leases[l].client_hash != 0) {
+                on_dropped(l, leases[l]);
+            }
+        }
+        leases = {};
+    }
+
+    // Exchange the leases with 'other'.
+    void swap(lease_db& other) {
+        std::swap(leases, other.leases);
+    }
+
+    // Get all lease slots, free slots have a 'client_hash' of 0.
+    const std::array<lease, LEASES>& entries() const {
+        return leases;
+    }
+
     // Get the number of active leases.
     usize active_leases() const {
         usize cnt = 0;
@@ -107,7 +204,7 @@ class lease_db {
     }
 
   private:
-    std::array<lease, LEASES> leases = {0, 0};
+    std::array<lease, LEASES> leases = {};
 };
 
 #endif
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#ifndef LEASE_EVENTS_H
+#define LEASE_EVENTS_H
+
+#include "types.h"
+
+#include <array>
+#include <atomic>
+#include <optional>
+
+// Max length of the client host name carried in a lease event, longer names
+// are truncated.
+constexpr usize LEASE_EVENT_HOSTNAME_LEN = 32;
+
+enum class lease_event_type : u8 {
+    // Lease bound to a client the first time.
+    NEW,
+    // Bound lease extended by the client.
+    RENEW,
+    // Bound lease expired or dropped by a reconfiguration and freed.
+    EXPIRE,
+};
+
+// Change of a bound lease, raised by the server (see 'dhcp_server').
+//
+// Offers are only reservations and don't raise events. Bound leases are freed
+// either on expiry or when 'reconfigure' drops them, both raise an EXPIRE for
+// the address, hence each NEW is eventually followed by an EXPIRE for the
+// same address.
+struct lease_event {
+    lease_event_type type;
+    u64 client_hash;
+    // Leased address in host byte order.
+    u32 addr;
+    // Absolute lease end, 0 for EXPIRE.
+    usize lease_end;
+    // Host name option (12) sent by the client, empty if not sent and always
+    // empty for EXPIRE.
+    char hostname[LEASE_EVENT_HOSTNAME_LEN + 1];
+};
+
+// Optional lease event sink.
+using event_fn = void (*)(const lease_event& ev);
+
+// Bounded lock-free ring of lease events with 'SLOTS' entries.
+//
+// Supports a single producer (the context handling dhcp messages) and a single
+// consumer. If the ring is full new events are dropped and counted, the
+// producer never waits for the consumer.
+template<usize SLOTS>
+class event_ring {
+    static_assert(SLOTS > 0 && (SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of two.");
+
+  public:
+    constexpr event_ring() = default;
+
+    event_ring(const event_ring&) = delete;
+    event_ring& operator=(const event_ring&) = delete;
+
+    // Append 'ev', return false if the ring is full and the event was dropped.
+    bool push(const lease_event& ev) {
+        const u32 h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == SLOTS) {
+            drops.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[h % SLOTS] = ev;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Remove the oldest event, nullopt if the ring is empty.
+    std::optional<lease_event> pop() {
+        const u32 t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return std::nullopt;
+        }
+        const lease_event ev = slots[t % SLOTS];
+        tail.store(t + 1, std::memory_order_release);
+        return ev;
+    }
+
+    // Get the number of events dropped because the ring was full.
+    u32 dropped() const {
+        return drops.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::array<lease_event, SLOTS> slots = {};
+    // Free running positions, written by the producer (head) and the consumer
+    // (tail) only.
+    std::atomic<u32> head{0};
+    std::atomic<u32> tail{0};
+    std::atomic<u32> drops{0};
+};
+
+#endif
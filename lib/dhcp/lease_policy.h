@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#ifndef LEASE_POLICY_H
+#define LEASE_POLICY_H
+
+#include "config.h"
+#include "types.h"
+
+#include <cmath>
+
+// Pool occupancy (in per mille) up to which the full lease time is granted.
+constexpr usize LEASE_POLICY_LOW_PERMILLE = 250;
+// Pool occupancy (in per mille) from which only the minimal lease time is
+// granted.
+constexpr usize LEASE_POLICY_HIGH_PERMILLE = 750;
+
+// Get the lease time for a new or renewed lease of 'pool', when 'active' of
+// 'capacity' leases are in use.
+//
+// Idle pools grant 'lease_time_secs' to keep renewal traffic low. Pools under
+// pressure grant leases down to 'lease_time_min_secs', such that addresses of
+// departed clients are freed early. In between the lease time decays
+// geometrically, such that it drops quickly once the pool fills up.
+//
+// Adaptive lease times are disabled if 'lease_time_min_secs' is 0.
+inline u32 adaptive_lease_time(const pool_config& pool, usize active, usize capacity) {
+    const u32 max = pool.lease_time_secs;
+    const u32 min = pool.lease_time_min_secs;
+    if (min == 0 || min >= max || capacity == 0) {
+        return max;
+    }
+
+    const usize occupancy = active * 1000 / capacity;
+    if (occupancy <= LEASE_POLICY_LOW_PERMILLE) {
+        return max;
+    }
+    if (occupancy >= LEASE_POLICY_HIGH_PERMILLE) {
+        return min;
+    }
+
+    const double frac = double(occupancy - LEASE_POLICY_LOW_PERMILLE) / (LEASE_POLICY_HIGH_PERMILLE - LEASE_POLICY_LOW_PERMILLE);
+    return static_cast<u32>(max * std::pow(double(min) / max, frac));
+}
+
+#endif
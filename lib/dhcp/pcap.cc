@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include "pcap.h"
+
+// ipv4 header checksum (rfc1071), ones complement sum over 16bit words.
+static u16 ipv4_checksum(const u8* hdr, usize len) {
+    u32 sum = 0;
+    for (usize i = 0; i + 1 < len; i += 2) {
+        sum += (u32(hdr[i]) << 8) | hdr[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<u16>(~sum);
+}
+
+pcap_file_header pcap_header() {
+    return {PCAP_MAGIC, PCAP_VERSION_MAJOR, PCAP_VERSION_MINOR, 0, 0, PCAP_MAX_FRAME_LEN, PCAP_LINKTYPE_RAW};
+}
+
+std::optional<usize> pcap_encode_frame(u8* frame, const pcap_packet& pkt) {
+    if (pkt.len > DHCP_MESSAGE_LEN) {
+        return std::nullopt;
+    }
+
+    const usize udp_len = PCAP_UDP_HDR_LEN + pkt.len;
+    const usize ip_len = PCAP_IPV4_HDR_LEN + udp_len;
+
+    // ipv4 header.
+    u8* ip = frame;
+    ip[0] = 0x45 /* version=4, ihl=5 */;
+    ip[1] = 0 /* tos */;
+    put_opt_val(ip + 2, static_cast<u16>(ip_len));
+    put_opt_val(ip + 4, u16(0) /* id */);
+    put_opt_val(ip + 6, u16(0) /* flags & fragment offset */);
+    ip[8] = 64 /* ttl */;
+    ip[9] = 17 /* udp */;
+    put_opt_val(ip + 10, u16(0) /* checksum */);
+    put_opt_val(ip + 12, pkt.src);
+    put_opt_val(ip + 16, pkt.dst);
+    put_opt_val(ip + 10, ipv4_checksum(ip, PCAP_IPV4_HDR_LEN));
+
+    // udp header, checksum is optional for ipv4 and left at 0.
+    u8* udp = ip + PCAP_IPV4_HDR_LEN;
+    put_opt_val(udp + 0, pkt.sport);
+    put_opt_val(udp + 2, pkt.dport);
+    put_opt_val(udp + 4, static_cast<u16>(udp_len));
+    put_opt_val(udp + 6, u16(0) /* checksum */);
+
+    std::memcpy(udp + PCAP_UDP_HDR_LEN, pkt.payload, pkt.len);
+
+    return ip_len;
+}
+
+std::optional<pcap_packet> pcap_decode_frame(const u8* frame, usize len, u32 linktype) {
+    if (linktype == PCAP_LINKTYPE_ETHERNET) {
+        // Only accept untagged ipv4 frames.
+        if (len < PCAP_ETH_HDR_LEN || get_opt_val<u16>(frame + 12) != 0x0800) {
+            return std::nullopt;
+        }
+        frame += PCAP_ETH_HDR_LEN;
+        len -= PCAP_ETH_HDR_LEN;
+    } else if (linktype != PCAP_LINKTYPE_RAW) {
+        return std::nullopt;
+    }
+
+    const u8* ip = frame;
+    if (len < PCAP_IPV4_HDR_LEN || (ip[0] >> 4) != 4 || ip[9] != 17 /* udp */) {
+        return std::nullopt;
+    }
+
+    // Reject fragments (MF flag or fragment offset set).
+    if (get_opt_val<u16>(ip + 6) & 0x3fff) {
+        return std::nullopt;
+    }
+
+    const usize ihl = (ip[0] & 0xf) * 4;
+    const usize ip_len = get_opt_val<u16>(ip + 2);
+    if (ihl < PCAP_IPV4_HDR_LEN || ip_len > len || ip_len < ihl + PCAP_UDP_HDR_LEN) {
+        return std::nullopt;
+    }
+
+    const u8* udp = ip + ihl;
+    const usize udp_len = get_opt_val<u16>(udp + 4);
+    if (udp_len < PCAP_UDP_HDR_LEN || udp_len > ip_len - ihl) {
+        return std::nullopt;
+    }
+
+    pcap_packet pkt;
+    pkt.ts_usec = 0;
+    pkt.src = get_opt_val<u32>(ip + 12);
+    pkt.dst = get_opt_val<u32>(ip + 16);
+    pkt.sport = get_opt_val<u16>(udp + 0);
+    pkt.dport = get_opt_val<u16>(udp + 2);
+    pkt.payload = udp + PCAP_UDP_HDR_LEN;
+    pkt.len = udp_len - PCAP_UDP_HDR_LEN;
+    return pkt;
+}
+
+std::optional<dhcp_operation> pcap_dhcp_op(const pcap_packet& pkt) {
+    if (pkt.sport != DHCP_SERVER_PORT && pkt.dport != DHCP_SERVER_PORT) {
+        return std::nullopt;
+    }
+
+    if (pkt.len < DHCP_MESSAGE_MIN_LEN) {
+        return std::nullopt;
+    }
+
+    const auto op = static_cast<dhcp_operation>(pkt.payload[0]);
+    if (op != dhcp_operation::BOOTREQUEST && op != dhcp_operation::BOOTREPLY) {
+        return std::nullopt;
+    }
+    return op;
+}
+
+bool pcap_reader::init() {
+    pcap_file_header fhdr;
+    if (len < sizeof(fhdr)) {
+        return false;
+    }
+    std::memcpy(&fhdr, data, sizeof(fhdr));
+
+    // Only native byte order files with usec timestamps are supported.
+    if (fhdr.magic != PCAP_MAGIC || fhdr.version_major != PCAP_VERSION_MAJOR) {
+        return false;
+    }
+
+    linktype = fhdr.network;
+    off = sizeof(fhdr);
+    return true;
+}
+
+std::optional<pcap_packet> pcap_reader::next() {
+    while (off < len) {
+        pcap_record_header rhdr;
+        if (len - off < sizeof(rhdr)) {
+            return std::nullopt;
+        }
+        std::memcpy(&rhdr, data + off, sizeof(rhdr));
+        off += sizeof(rhdr);
+
+        if (len - off < rhdr.incl_len) {
+            return std::nullopt;
+        }
+        const u8* frame = data + off;
+        off += rhdr.incl_len;
+
+        if (auto pkt = pcap_decode_frame(frame, rhdr.incl_len, linktype)) {
+            pkt->ts_usec = u64(rhdr.ts_sec) * 1000000 + rhdr.ts_usec;
+            return pkt;
+        }
+    }
+    return std::nullopt;
+}
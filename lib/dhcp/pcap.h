@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+//
+// pcap format: https://wiki.wireshark.org/Development/LibpcapFileFormat
+
+#ifndef PCAP_H
+#define PCAP_H
+
+#include "dhcp.h"
+#include "types.h"
+
+#include <array>
+#include <cstring>
+#include <optional>
+
+// -- Global constants.
+
+constexpr u32 PCAP_MAGIC = 0xa1b2c3d4; /* usec timestamps */
+constexpr u16 PCAP_VERSION_MAJOR = 2;
+constexpr u16 PCAP_VERSION_MINOR = 4;
+
+constexpr u32 PCAP_LINKTYPE_ETHERNET = 1;
+constexpr u32 PCAP_LINKTYPE_RAW = 101; /* Raw ipv4/ipv6 */
+
+constexpr usize PCAP_IPV4_HDR_LEN = 20;
+constexpr usize PCAP_UDP_HDR_LEN = 8;
+constexpr usize PCAP_ETH_HDR_LEN = 14;
+
+// Largest frame we write, ipv4 + udp header followed by the dhcp message.
+constexpr usize PCAP_MAX_FRAME_LEN = PCAP_IPV4_HDR_LEN + PCAP_UDP_HDR_LEN + DHCP_MESSAGE_LEN;
+
+// -- pcap file format (written in host byte order).
+
+struct pcap_file_header {
+    u32 magic;
+    u16 version_major;
+    u16 version_minor;
+    u32 thiszone;
+    u32 sigfigs;
+    u32 snaplen;
+    u32 network;
+} __attribute__((packed));
+
+struct pcap_record_header {
+    u32 ts_sec;
+    u32 ts_usec;
+    u32 incl_len;
+    u32 orig_len;
+} __attribute__((packed));
+
+// -- pcap utilities.
+
+// UDP packet carrying a dhcp message, addresses in host byte order.
+struct pcap_packet {
+    u64 ts_usec;
+    u32 src;
+    u32 dst;
+    u16 sport;
+    u16 dport;
+    const u8* payload;
+    usize len;
+};
+
+// Get the pcap file header for the frames written by 'pcap_encode_frame'.
+pcap_file_header pcap_header();
+
+// Encode 'pkt' as raw ipv4/udp frame into 'frame' which must be at least
+// PCAP_MAX_FRAME_LEN bytes large.
+//
+// Return the length of the encoded frame or nullopt if the payload is too large.
+std::optional<usize> pcap_encode_frame(u8* frame, const pcap_packet& pkt);
+
+// Decode an ipv4/udp frame of the link type 'linktype'.
+//
+// On success the returned packet payload points into 'frame'. Non ipv4/udp
+// frames or fragmented packets are rejected.
+std::optional<pcap_packet> pcap_decode_frame(const u8* frame, usize len, u32 linktype);
+
+// Get the operation of the dhcp message carried by 'pkt'.
+//
+// Relay agents send requests and receive replies on the server port, hence
+// requests and replies are told apart by the operation and not by the port.
+// Return nullopt if 'pkt' is not sent from or to the server port or carries
+// no dhcp message.
+std::optional<dhcp_operation> pcap_dhcp_op(const pcap_packet& pkt);
+
+// Write 'pkt' as pcap record through 'write(const u8*, usize)', use this to
+// capture into a file. The file must start with the 'pcap_header()'.
+template<typename W>
+bool pcap_write_record(W&& write, const pcap_packet& pkt) {
+    u8 frame[PCAP_MAX_FRAME_LEN];
+    const auto len = pcap_encode_frame(frame, pkt);
+    if (!len) {
+        return false;
+    }
+
+    const pcap_record_header rhdr = {
+        static_cast<u32>(pkt.ts_usec / 1000000),
+        static_cast<u32>(pkt.ts_usec % 1000000),
+        static_cast<u32>(len.value()),
+        static_cast<u32>(len.value()),
+    };
+    write(reinterpret_cast<const u8*>(&rhdr), sizeof(rhdr));
+    write(frame, len.value());
+    return true;
+}
+
+// Iterate over the records of an in-memory pcap file.
+class pcap_reader {
+  public:
+    pcap_reader(const u8* data, usize len) : data(data), len(len) {}
+
+    // Validate the pcap file header, must be called before 'next'.
+    bool init();
+
+    // Get the next udp packet, non udp records are skipped.
+    // Return nullopt at the end of the file or if the file is malformed.
+    std::optional<pcap_packet> next();
+
+  private:
+    const u8* data;
+    usize len;
+    usize off = 0;
+    u32 linktype = 0;
+};
+
+// Fixed size capture buffer, keeping the last 'SLOTS' frames.
+//
+// Frames are encoded on 'push', hence dumping the buffer only needs to copy
+// out the bytes. With 'SLOTS' = 0 capturing is disabled and compiled out.
+template<usize SLOTS>
+class pcap_ring {
+  public:
+    constexpr pcap_ring() = default;
+
+    pcap_ring(const pcap_ring&) = delete;
+    pcap_ring& operator=(const pcap_ring&) = delete;
+
+    // Capture 'pkt', overwriting the oldest frame if the buffer is full.
+    void push(const pcap_packet& pkt) {
+        if constexpr (SLOTS > 0) {
+            slot& s = slots[head];
+            const auto len = pcap_encode_frame(s.frame, pkt);
+            if (!len) {
+                return;
+            }
+
+            s.hdr.ts_sec = static_cast<u32>(pkt.ts_usec / 1000000);
+            s.hdr.ts_usec = static_cast<u32>(pkt.ts_usec % 1000000);
+            s.hdr.incl_len = static_cast<u32>(len.value());
+            s.hdr.orig_len = static_cast<u32>(len.value());
+
+            head = (head + 1) % SLOTS;
+            count = count < SLOTS ? count + 1 : SLOTS;
+        }
+    }
+
+    // Write the captured frames as pcap file through 'write(const u8*, usize)',
+    // oldest frame first.
+    template<typename W>
+    void dump(W&& write) const {
+        const pcap_file_header fhdr = pcap_header();
+        write(reinterpret_cast<const u8*>(&fhdr), sizeof(fhdr));
+
+        if constexpr (SLOTS > 0) {
+            for (usize i = 0; i < count; ++i) {
+                const slot& s = slots[(head + SLOTS - count + i) % SLOTS];
+                write(reinterpret_cast<const u8*>(&s.hdr), sizeof(s.hdr));
+                write(s.frame, s.hdr.incl_len);
+            }
+        }
+    }
+
+    // Get the number of captured frames.
+    usize size() const {
+        return count;
+    }
+
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+
+  private:
+    struct slot {
+        pcap_record_header hdr;
+        u8 frame[PCAP_MAX_FRAME_LEN];
+    };
+
+    std::array<slot, SLOTS> slots = {};
+    usize head = 0;
+    usize count = 0;
+};
+
+#endif
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#ifndef POOL_INDEX_H
+#define POOL_INDEX_H
+
+#include "types.h"
+
+#include <algorithm>
+#include <array>
+#include <optional>
+
+// Address range [first, last] of a pool, addresses in host byte order.
+struct pool_range {
+    u32 first;
+    u32 last;
+};
+
+// Interval index to select the pool for an address (eg the giaddr of a relay
+// agent).
+//
+// The ranges are kept sorted by their first address, which allows to look up
+// an address with a binary search in O(log n).
+//
+// The index supports 'POOLS' number of ranges.
+template<usize POOLS>
+class pool_index {
+  public:
+    constexpr pool_index() = default;
+
+    // Build the index from 'n' 'ranges', the position of a range in 'ranges'
+    // is the pool id returned by 'find'.
+    //
+    // Return false if there are too many ranges, a range is malformed or
+    // ranges overlap, in that case the index is empty.
+    bool build(const pool_range* ranges, usize n) {
+        len = 0;
+        if (n > POOLS) {
+            return false;
+        }
+
+        for (usize i = 0; i < n; ++i) {
+            if (ranges[i].first > ranges[i].last) {
+                return false;
+            }
+            entries[i] = {ranges[i], i};
+        }
+
+        std::sort(entries.begin(), entries.begin() + n, [](const entry& a, const entry& b) { return a.range.first < b.range.first; });
+
+        for (usize i = 1; i < n; ++i) {
+            if (entries[i].range.first <= entries[i - 1].range.last) {
+                return false;
+            }
+        }
+
+        len = n;
+        return true;
+    }
+
+    // Get the pool id of the range containing 'addr'.
+    std::optional<usize> find(u32 addr) const {
+        // First range starting after 'addr', the candidate is the one before.
+        const auto it = std::upper_bound(entries.begin(), entries.begin() + len, addr,
+                                         [](u32 addr, const entry& e) { return addr < e.range.first; });
+        if (it == entries.begin()) {
+            return std::nullopt;
+        }
+
+        const entry& e = *(it - 1);
+        if (addr > e.range.last) {
+            return std::nullopt;
+        }
+        return e.pool;
+    }
+
+    // Get the number of indexed ranges.
+    usize size() const {
+        return len;
+    }
+
+  private:
+    struct entry {
+        pool_range range;
+        usize pool;
+    };
+
+    std::array<entry, POOLS> entries = {};
+    usize len = 0;
+};
+
+#endif
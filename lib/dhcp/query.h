@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "server.h"
+#include "types.h"
+
+#include <cstdio>
+
+// Write the server snapshot 'snap' as text with 'write(const char* str, usize
+// len)', one line per item:
+//
+//   time 120
+//   stats received 4 discovers 2 requests 2 offers 2 acks 2 exhausted 0
+//   pool 0 start 10.0.0.10 active 2/16
+//   lease 10.0.0.10 client 3f2a0c9e1b7d4410 expires 28800
+//   lease 10.0.0.11 client 9c0e4d21aa03b8f2 expires 28801
+//
+// 'expires' is the absolute lease end, compare against 'time'.
+template<usize LEASES, typename W>
+void format_snapshot(const server_snapshot<LEASES>& snap, W write) {
+    char line[96];
+
+    const auto emit = [&](int len) {
+        if (len > 0) {
+            write(line, static_cast<usize>(len) < sizeof(line) ? len : sizeof(line) - 1);
+        }
+    };
+
+    const auto ip = [](u32 addr, char (&buf)[16]) {
+        std::snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (addr >> 24) & 0xff, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff);
+        return buf;
+    };
+    char addr[16];
+
+    const server_stats& s = snap.stats;
+    emit(std::snprintf(line, sizeof(line), "time %lu\n", (unsigned long)snap.now_secs));
+    emit(std::snprintf(line, sizeof(line), "stats received %u discovers %u requests %u offers %u acks %u exhausted %u\n",
+                       (unsigned)s.received, (unsigned)s.discovers, (unsigned)s.requests, (unsigned)s.offers, (unsigned)s.acks,
+                       (unsigned)s.exhausted));
+
+    for (usize p = 0; p < snap.npools; ++p) {
+        const auto& pool = snap.pools[p];
+        emit(std::snprintf(line, sizeof(line), "pool %u start %s active %u/%u\n", (unsigned)p, ip(pool.lease_start, addr),
+                           (unsigned)pool.active, (unsigned)LEASES));
+
+        for (usize l = 0; l < LEASES; ++l) {
+            const lease& ls = pool.leases[l];
+            if (ls.client_hash == 0) {
+                continue;
+            }
+            emit(std::snprintf(line, sizeof(line), "lease %s client %08x%08x expires %lu\n", ip(pool.lease_start + l, addr),
+                               (unsigned)(ls.client_hash >> 32), (unsigned)ls.client_hash, (unsigned long)ls.lease_end));
+        }
+    }
+}
+
+#endif
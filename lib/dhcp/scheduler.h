@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "types.h"
+
+#include <array>
+
+// Maintenance task step, 'now_us' is the current time in microseconds.
+//
+// A step should only do a small bounded amount of work and return true if the
+// task has more work pending, in that case the task is rescheduled
+// immediately, else it is rescheduled after its period.
+using task_fn = bool (*)(u64 now_us);
+
+// Cooperative scheduler for maintenance tasks.
+//
+// Tasks are only run from 'run', which should be called when no packets are
+// pending. 'run' executes due tasks round robin until the time budget is used
+// up or the preemption check reports pending traffic. Steps are never
+// interrupted, the budget is checked between steps.
+//
+// The scheduler supports 'TASKS' number of tasks.
+template<usize TASKS>
+class scheduler {
+    static_assert(TASKS > 0, "Scheduler must support at least one task.");
+
+  public:
+    constexpr scheduler() = default;
+
+    scheduler(const scheduler&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+
+    // Register the task 'step' to be run every 'period_us' microseconds.
+    // The first run of the task is due immediately.
+    //
+    // Return false if all task slots are in use.
+    bool add(task_fn step, u64 period_us) {
+        for (task& t : tasks) {
+            if (t.step == nullptr) {
+                t = {step, period_us, 0};
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Run due tasks for at most 'budget_us' microseconds.
+    //
+    // 'now_us()' returns the current time in microseconds and 'preempt()'
+    // returns true if pending work (eg a received packet) should preempt the
+    // maintenance tasks.
+    //
+    // Return the number of executed task steps.
+    template<typename NOW, typename PREEMPT>
+    usize run(NOW&& now_us, PREEMPT&& preempt, u64 budget_us) {
+        const u64 start = now_us();
+        u64 now = start;
+        usize steps = 0;
+
+        while (now - start < budget_us && !preempt()) {
+            task* t = next_due(now);
+            if (t == nullptr) {
+                break;
+            }
+
+            const bool more = t->step(now);
+            ++steps;
+
+            now = now_us();
+            t->next_us = more ? now : now + t->period_us;
+        }
+        return steps;
+    }
+
+  private:
+    struct task {
+        task_fn step;
+        u64 period_us;
+        u64 next_us;
+    };
+
+    // Find the next due task, round robin starting after the last run task.
+    task* next_due(u64 now) {
+        for (usize i = 0; i < TASKS; ++i) {
+            const usize idx = (last + 1 + i) % TASKS;
+            task& t = tasks[idx];
+            if (t.step != nullptr && t.next_us <= now) {
+                last = idx;
+                return &t;
+            }
+        }
+        return nullptr;
+    }
+
+    std::array<task, TASKS> tasks = {};
+    usize last = TASKS - 1;
+};
+
+#endif
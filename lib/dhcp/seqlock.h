@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include "types.h"
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+// Sequence lock protecting a value of type 'T'.
+//
+// The writer updates the value in place and never waits for readers. Readers
+// copy the value and retry if a write was in progress during the copy, hence
+// readers never block the writer but may retry under frequent writes.
+//
+// Supports concurrent readers and a single writer.
+template<typename T>
+class seqlock {
+    static_assert(std::is_trivially_copyable_v<T>, "Readers copy the value bytewise.");
+
+  public:
+    constexpr seqlock() = default;
+
+    seqlock(const seqlock&) = delete;
+    seqlock& operator=(const seqlock&) = delete;
+
+    // Update the value in place with 'fill(T&)'.
+    template<typename F>
+    void write(F&& fill) {
+        const u32 s = seq.load(std::memory_order_relaxed);
+        // Odd sequence marks a write in progress.
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        fill(val);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // Copy a consistent value into 'out'.
+    //
+    // Return the number of writes so far, 0 if the value was never written.
+    u32 read(T& out) const {
+        for (;;) {
+            const u32 s = seq.load(std::memory_order_acquire);
+            if (s & 1) {
+                continue;
+            }
+
+            // The copy may race with the writer, it is discarded in that case.
+            std::memcpy(static_cast<void*>(&out), static_cast<const void*>(&val), sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == s) {
+                return s / 2;
+            }
+        }
+    }
+
+  private:
+    std::atomic<u32> seq{0};
+    T val = {};
+};
+
+#endif
@@ -0,0 +1,563 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "config.h"
+#include "dhcp.h"
+#include "lease_db.h"
+#include "lease_events.h"
+#include "lease_policy.h"
+#include "types.h"
+#include "utils.h"
+
+#include <cstring>
+#include <optional>
+
+// Reply to be sent out by the platform io handler.
+//
+// The reply message is crafted in-place in the dhcp message passed to
+// 'handle_dhcp_message'.
+struct dhcp_reply {
+    usize len;
+    u32 dst;
+    u16 port;
+};
+
+// Message counters of the server, wrap around on overflow.
+//
+// Messages without reply (malformed, unknown clients, exhausted pools) are
+// 'received - offers - acks'.
+struct server_stats {
+    u32 received;
+    u32 discovers;
+    u32 requests;
+    u32 offers;
+    u32 acks;
+    // DHCP_DISCOVER without free lease in the pool.
+    u32 exhausted;
+};
+
+// Point in time copy of the server state, see 'dhcp_server::snapshot'.
+template<usize LEASES>
+struct server_snapshot {
+    // Time the snapshot was taken (absolute time value in seconds).
+    usize now_secs;
+    server_stats stats;
+
+    struct pool_snapshot {
+        u32 lease_start;
+        usize active;
+        // Lease idx is the offset to 'lease_start'.
+        std::array<lease, LEASES> leases;
+    };
+
+    usize npools;
+    std::array<pool_snapshot, CONFIG_MAX_POOLS> pools;
+};
+
+// Optional logger, printf like.
+using log_fn = void (*)(const char* fmt, ...);
+
+// Platform independent dhcp server engine.
+//
+// The server does not do any io nor does it query time, the platform code
+// receives messages, passes them to 'handle_dhcp_message' together with the
+// current time and sends out the reply if there is one.
+//
+// This allows to run the same engine on the embedded target, the host and in
+// tests.
+//
+// The server is not thread safe, all methods must be called from the same
+// context (the one handling dhcp messages).
+//
+// Each configured pool has its own lease database supporting 'LEASES' number
+// of clients. Messages relayed by a relay agent are served from the pool whose
+// network contains the relay agent address (giaddr), other messages are
+// served from the pool of the local network.
+//
+// Binding, renewing and expiring leases raises lease events to the optional
+// event sink, bound leases dropped by 'reconfigure' raise EXPIRE events.
+template<usize LEASES>
+class dhcp_server {
+  public:
+    // 'id_key' keys the fingerprints of the client identifiers and should be
+    // random per boot.
+    //
+    // 'events' is called from 'handle_dhcp_message', 'flush_expired' and
+    // 'reconfigure' and should only queue the event (eg in an 'event_ring').
+    explicit dhcp_server(const server_config& cfg, log_fn log = nullptr, u64 id_key = 0, event_fn events = nullptr) :
+        state(make_state(cfg)), log(log), id_key(id_key), events(events) {}
+
+    dhcp_server(const dhcp_server&) = delete;
+    dhcp_server& operator=(const dhcp_server&) = delete;
+
+    // Handle the received dhcp message 'msg' of length 'len'.
+    //
+    // 'now_secs' should be the current time as absolute time value in seconds.
+    //
+    // If the message requires a response, the reply is crafted in-place in
+    // 'msg' and the reply destination is returned, else return nullopt.
+    std::optional<dhcp_reply> handle_dhcp_message(dhcp_message& msg, usize len, usize now_secs);
+
+    // Free expired leases, 'now_secs' should be the current time as absolute
+    // time value in seconds.
+    //
+    // This is maintenance work and should be run periodically outside of the
+    // packet path.
+    void flush_expired(usize now_secs) {
+        for (usize p = 0; p < state.cfg.npools; ++p) {
+            flush_pool(p, state.cfg.pools[p].lease_start, now_secs);
+        }
+    }
+
+    // Switch to the configuration 'next'.
+    //
+    // Leases of pools which exist in the old and the new configuration (same
+    // network) are migrated, such that clients keep their address if it is
+    // still part of the new range. Leases of removed pools are dropped, bound
+    // leases dropped raise EXPIRE events with their old address.
+    //
+    // Return false if the pools of 'next' overlap or a lease range is invalid
+    // for 'LEASES' leases (see 'find_invalid_pool'), the current configuration
+    // is kept.
+    bool reconfigure(const server_config& next);
+
+    const server_config& config() const {
+        return state.cfg;
+    }
+
+    const lease_db<LEASES>& leases(usize pool = 0) const {
+        return dbs[pool];
+    }
+
+    const server_stats& stats() const {
+        return counters;
+    }
+
+    // Copy the counters and lease databases into 'out', 'now_secs' should be
+    // the current time as absolute time value in seconds.
+    //
+    // Must be called from the same context as 'handle_dhcp_message', publish
+    // the snapshot (eg with a 'seqlock') to query it from other contexts.
+    void snapshot(server_snapshot<LEASES>& out, usize now_secs) const {
+        out.now_secs = now_secs;
+        out.stats = counters;
+        out.npools = state.cfg.npools;
+        for (usize p = 0; p < out.npools; ++p) {
+            out.pools[p].lease_start = state.cfg.pools[p].lease_start;
+            out.pools[p].active = dbs[p].active_leases();
+            out.pools[p].leases = dbs[p].entries();
+        }
+    }
+
+  private:
+    // Configuration together with the derived pool index.
+    struct server_state {
+        server_config cfg;
+        pool_index<CONFIG_MAX_POOLS> index;
+    };
+
+    static server_state make_state(const server_config& cfg) {
+        server_state st = {cfg, {}};
+
+        std::array<pool_range, CONFIG_MAX_POOLS> ranges;
+        for (usize p = 0; p < cfg.npools; ++p) {
+            ranges[p] = network_range(cfg.pools[p]);
+        }
+        // On overlapping pools the index stays empty and only the local pool is served.
+        st.index.build(ranges.data(), cfg.npools);
+        return st;
+    }
+
+    // Free the expired leases of pool 'pool_id' and raise EXPIRE events for
+    // bound leases.
+    void flush_pool(usize pool_id, u32 lease_start, usize now_secs) {
+        dbs[pool_id].flush_expired(now_secs, [&](usize idx, const lease& l) { raise_expire(lease_start, idx, l); });
+    }
+
+    // Raise an EXPIRE event for lease 'l' at position 'idx' of the range
+    // starting at 'lease_start', if the lease is bound.
+    void raise_expire(u32 lease_start, usize idx, const lease& l) {
+        if (events && l.bound) {
+            events({lease_event_type::EXPIRE, l.client_hash, lease_start + static_cast<u32>(idx), 0, ""});
+        }
+    }
+
+    // Raise a NEW or RENEW event for the lease at 'addr' bound to
+    // 'client_hash', the host name is taken from the client options 'opts'.
+    void raise_bound(bool renew, u64 client_hash, u32 addr, usize lease_end, const u8* opts, usize opt_len) {
+        if (!events) {
+            return;
+        }
+
+        lease_event ev = {renew ? lease_event_type::RENEW : lease_event_type::NEW, client_hash, addr, lease_end, ""};
+        if (const auto name = get_option(opts, opt_len, dhcp_option::HOST_NAME)) {
+            const usize len = name->len < LEASE_EVENT_HOSTNAME_LEN ? name->len : LEASE_EVENT_HOSTNAME_LEN;
+            std::memcpy(ev.hostname, name->data, len);
+            ev.hostname[len] = '\0';
+        }
+        events(ev);
+    }
+
+    server_state state;
+    log_fn log;
+    u64 id_key;
+    event_fn events;
+    std::array<lease_db<LEASES>, CONFIG_MAX_POOLS> dbs;
+    server_stats counters = {};
+};
+
+template<usize LEASES>
+bool dhcp_server<LEASES>::reconfigure(const server_config& next) {
+    const server_state st = make_state(next);
+    if (st.index.size() != next.npools || find_invalid_pool(next, LEASES)) {
+        return false;
+    }
+
+    const server_config curr = state.cfg;
+    state = st;
+
+    // For each new pool find the old pool with the same network.
+    constexpr usize NONE = CONFIG_MAX_POOLS;
+    std::array<usize, CONFIG_MAX_POOLS> from;
+    for (usize n = 0; n < next.npools; ++n) {
+        from[n] = NONE;
+        for (usize o = 0; o < curr.npools; ++o) {
+            const pool_range next_net = network_range(next.pools[n]);
+            const pool_range curr_net = network_range(curr.pools[o]);
+            if (next_net.first == curr_net.first && next_net.last == curr_net.last) {
+                from[n] = o;
+                break;
+            }
+        }
+    }
+
+    // Move the lease databases into the position of the new pool.
+    // 'at[p]' is the old pool whose leases are currently at position 'p', and
+    // 'pos[o]' the current position of the leases of old pool 'o'.
+    std::array<usize, CONFIG_MAX_POOLS> at, pos;
+    for (usize p = 0; p < CONFIG_MAX_POOLS; ++p) {
+        at[p] = pos[p] = p;
+    }
+    for (usize n = 0; n < next.npools; ++n) {
+        if (from[n] == NONE || pos[from[n]] == n) {
+            continue;
+        }
+        const usize p = pos[from[n]];
+        dbs[n].swap(dbs[p]);
+        std::swap(at[n], at[p]);
+        pos[at[n]] = n;
+        pos[at[p]] = p;
+    }
+
+    for (usize n = 0; n < CONFIG_MAX_POOLS; ++n) {
+        // Range of the old pool whose leases are at position 'n'.
+        const u32 lease_start = at[n] < curr.npools ? curr.pools[at[n]].lease_start : 0;
+        const auto on_dropped = [&](usize idx, const lease& l) { raise_expire(lease_start, idx, l); };
+
+        if (n >= next.npools || from[n] == NONE) {
+            dbs[n].clear(on_dropped);
+        } else if (next.pools[n].lease_start != lease_start) {
+            dbs[n].rebase(static_cast<long>(next.pools[n].lease_start) - static_cast<long>(lease_start), on_dropped);
+        }
+    }
+    return true;
+}
+
+#define SERVER_LOG(fmt, ...)            \
+    do {                                \
+        if (log) {                      \
+            log(fmt, ##__VA_ARGS__);    \
+        }                               \
+    } while (0)
+
+template<usize LEASES>
+std::optional<dhcp_reply> dhcp_server<LEASES>::handle_dhcp_message(dhcp_message& msg, usize len, usize now_secs) {
+    ++counters.received;
+
+    // Sanity check dhcp message.
+    if (len < DHCP_MESSAGE_MIN_LEN || len > sizeof(msg) || msg.op != dhcp_operation::BOOTREQUEST || msg.cookie != DHCP_OPTION_COOKIE) {
+        return std::nullopt;
+    }
+
+    // Length of the filled in client options.
+    const usize opt_len = len - (msg.options - (const u8*)&msg);
+
+    // Each dhcp message must contain the dhcp message type (state in the protocol).
+    const auto msg_type = ({
+        auto opt = TRY(get_option(msg.options, opt_len, dhcp_option::DHCP_MESSAGE_TYPE));
+        from_raw<dhcp_message_type>(opt.data[0]);
+    });
+
+    // Select the pool, relayed messages are served from the pool of the relay
+    // agent network, renewals sent directly by the client from the pool of the
+    // client address, others from the local pool.
+    const u32 giaddr = get_opt_val<u32>((const u8*)&msg.giaddr);
+    const u32 ciaddr = get_opt_val<u32>((const u8*)&msg.ciaddr);
+    usize pool_id = 0;
+    if (giaddr != 0) {
+        pool_id = TRY(state.index.find(giaddr));
+    } else if (ciaddr != 0 && msg_type == dhcp_message_type::DHCP_REQUEST) {
+        pool_id = state.index.find(ciaddr).value_or(0);
+    }
+    const pool_config& pool = state.cfg.pools[pool_id];
+    lease_db<LEASES>& db = dbs[pool_id];
+
+    // Compute client fingerprint, using the CLIENT_ID option if available
+    // else use the hardware address.
+    u64 client_hash;
+    if (const auto client_id = get_option(msg.options, opt_len, dhcp_option::CLIENT_ID)) {
+        client_hash = hash64(client_id->data, client_id->len, id_key);
+    } else {
+        client_hash = hash64(msg.chaddr, msg.hlen > sizeof(msg.chaddr) ? sizeof(msg.chaddr) : msg.hlen, id_key);
+    }
+
+    // Extract the dhcp options requested by the client (using 16 was sufficient in my case).
+    dhcp_option requested_param[16];
+    usize requested_param_len = 0;
+    if (const auto opt = get_option(msg.options, opt_len, dhcp_option::PARAMETER_REQUEST_LIST)) {
+        requested_param_len = opt->len > sizeof(requested_param) ? sizeof(requested_param) : opt->len;
+
+        for (usize i = 0; i < requested_param_len; ++i) {
+            requested_param[i] = from_raw<dhcp_option>(opt->data[i]);
+        }
+    }
+
+    usize lease_id;
+    dhcp_message_type resp_msg;
+    bool rapid_commit = false;
+
+    // Lease time granted for this message, shorter while the pool is under
+    // pressure.
+    const u32 lease_time_secs = pool.lease_time_min_secs ? adaptive_lease_time(pool, db.active_leases(), LEASES) : pool.lease_time_secs;
+
+    switch (msg_type) {
+        case dhcp_message_type::DHCP_DISCOVER: {
+            SERVER_LOG("Received DHCP_DISCOVER client_hash=%08x%08x pool=%u\n", u32(client_hash >> 32), u32(client_hash),
+                       unsigned(pool_id));
+            ++counters.discovers;
+
+            if (const auto lease = db.get_lease(client_hash)) {
+                // We already have a lease for this client, the lease may
+                // already be expired but not yet flushed, hence make sure the
+                // offer stays reserved for a short amount of time.
+                lease_id = lease.value();
+                if (db.lease_end(lease_id) < now_secs + 15 /* secs */) {
+                    db.update_lease(client_hash, now_secs + 15 /* secs */);
+                }
+            } else {
+                // Allocate a new lease for this client and reserve for a short
+                // amount of time.
+                //
+                // Expired leases are flushed by periodic maintenance, only if
+                // the pool looks exhausted flush inline and retry.
+                auto new_lease = db.new_lease(client_hash, now_secs + 15 /* secs */);
+                if (!new_lease) {
+                    flush_pool(pool_id, pool.lease_start, now_secs);
+                    new_lease = db.new_lease(client_hash, now_secs + 15 /* secs */);
+                }
+                if (!new_lease) {
+                    SERVER_LOG("Pool %u exhausted\n", unsigned(pool_id));
+                    ++counters.exhausted;
+                    return std::nullopt;
+                }
+                lease_id = new_lease.value();
+            }
+
+            // DHCP message type answer.
+            resp_msg = dhcp_message_type::DHCP_OFFER;
+
+            // Client asks for the two message exchange (rfc4039), commit the
+            // lease right away and skip the DHCP_OFFER/DHCP_REQUEST round.
+            if (state.cfg.rapid_commit && get_option(msg.options, opt_len, dhcp_option::RAPID_COMMIT)) {
+                SERVER_LOG("Rapid commit client_hash=%08x%08x pool=%u\n", u32(client_hash >> 32), u32(client_hash), unsigned(pool_id));
+                const auto renew = db.bind_lease(client_hash, now_secs + lease_time_secs /* secs */);
+                raise_bound(renew.value_or(false), client_hash, pool.lease_start + lease_id, now_secs + lease_time_secs, msg.options,
+                            opt_len);
+                resp_msg = dhcp_message_type::DHCP_ACK;
+                rapid_commit = true;
+            }
+        } break;
+
+        case dhcp_message_type::DHCP_REQUEST: {
+            SERVER_LOG("Received DHCP_REQUEST client_hash=%08x%08x pool=%u\n", u32(client_hash >> 32), u32(client_hash), unsigned(pool_id));
+            ++counters.requests;
+
+            // Get server identifier specified by client, it is only sent in
+            // the SELECTING state. Clients in the RENEWING and REBINDING
+            // state send their current address in 'ciaddr' instead, the
+            // INIT-REBOOT state (neither) is not supported (rfc2131 4.3.2).
+            const auto server_id = get_option(msg.options, opt_len, dhcp_option::SERVER_IDENTIFIER);
+            if (server_id) {
+                // Check if dhcp message was ment for us.
+                if (get_opt_val<u32>(server_id->data) != state.cfg.local_ip) {
+                    return std::nullopt;
+                }
+            } else if (ciaddr == 0) {
+                return std::nullopt;
+            }
+
+            // Client is now requesting the offered lease (or extending its
+            // lease), at that stage the lease should have been allocated.
+            lease_id = TRY(db.get_lease(client_hash));
+
+            // Renewing clients must own the address they renew.
+            if (!server_id && pool.lease_start + lease_id != ciaddr) {
+                return std::nullopt;
+            }
+
+            // Bind the lease with the proper lease expiration time (absolute
+            // time).
+            const auto renew = db.bind_lease(client_hash, now_secs + lease_time_secs /* secs */);
+            raise_bound(renew.value_or(false), client_hash, pool.lease_start + lease_id, now_secs + lease_time_secs, msg.options, opt_len);
+
+            // DHCP message type answer.
+            resp_msg = dhcp_message_type::DHCP_ACK;
+        } break;
+
+        default: {
+            SERVER_LOG("Received unexpected DHCP MESSAGE TYPE %d\n", into_raw(msg_type));
+            return std::nullopt;
+        }
+    }
+
+    // Craft response package.
+
+    // Compute client id based on start address of dhcp range and lease idx.
+    const u32 client_addr = pool.lease_start + lease_id;
+
+    // From rfc2131 Table 3:
+    //
+    // Field      DHCPOFFER   DHCPACK
+    // -----      ---------   -------
+    // 'op'       BOOTREPLY   BOOTREPLY
+    // 'htype'    keep        keep
+    // 'hlen'     keep        keep
+    // 'hops'     0           0
+    // 'xid'      keep        keep
+    // 'secs'     0           0
+    // 'ciaddr'   0           'ciaddr' from DHCPREQUEST or 0
+    // 'yiaddr'   IP address offered to client
+    // 'siaddr'   IP address of next bootstrap server
+    // 'flags'    keep        keep
+    // 'giaddr'   keep        keep
+    // 'chaddr'   keep        keep
+    // 'sname'    Server host name or options
+    // 'file'     Client boot file name or options
+
+    msg.op = dhcp_operation::BOOTREPLY;
+    msg.hops = 0;
+    msg.secs = 0;
+    // Keep 'ciaddr' of a renewing client.
+    const u32 reply_ciaddr = msg_type == dhcp_message_type::DHCP_REQUEST ? ciaddr : 0;
+    put_opt_val((u8*)&msg.ciaddr, reply_ciaddr);
+    put_opt_val((u8*)&msg.yiaddr, client_addr);
+    put_opt_val((u8*)&msg.siaddr, state.cfg.local_ip);
+
+    // From rfc2131 Table 3:
+    //
+    // Option                    DHCPOFFER   DHCPACK
+    // ------                    ---------   -------
+    // IP address lease time     MUST        MUST (DHCPREQUEST)
+    // DHCP message type         DHCPOFFER   DHCPACK
+    // Server identifier         MUST        MUST
+
+    u8* optp = msg.options;
+
+    // DHCP message type.
+    *optp++ = into_raw(dhcp_option::DHCP_MESSAGE_TYPE);
+    *optp++ = 1 /* len */;
+    *optp++ = into_raw(resp_msg);
+
+    // Server identifier.
+    *optp++ = into_raw(dhcp_option::SERVER_IDENTIFIER);
+    *optp++ = 4 /* len */;
+    optp = put_opt_val(optp, state.cfg.local_ip);
+
+    // Lease time.
+    *optp++ = into_raw(dhcp_option::IP_ADDRESS_LEASE_TIME);
+    *optp++ = 4 /* len */;
+    optp = put_opt_val(optp, lease_time_secs);
+
+    // Renewal time.
+    *optp++ = into_raw(dhcp_option::RENEWAL_TIME_T1);
+    *optp++ = 4 /* len */;
+    optp = put_opt_val(optp, lease_time_secs / 2);
+
+    // Rebind time.
+    *optp++ = into_raw(dhcp_option::REBINDING_TIME_T2);
+    *optp++ = 4 /* len */;
+    optp = put_opt_val(optp, lease_time_secs * 8 / 12);
+
+    // Rapid commit, must be included in a DHCP_ACK answering a DHCP_DISCOVER
+    // (rfc4039 4.).
+    if (rapid_commit) {
+        *optp++ = into_raw(dhcp_option::RAPID_COMMIT);
+        *optp++ = 0 /* len */;
+    }
+
+    // Add options requested by client that we support.
+    for (usize i = 0; i < requested_param_len; ++i) {
+        auto opt = requested_param[i];
+        switch (opt) {
+            case dhcp_option::SUBNET_MASK: {
+                // Subnet mask.
+                *optp++ = into_raw(opt);
+                *optp++ = 4 /* len */;
+                optp = put_opt_val(optp, pool.subnet);
+            } break;
+
+            case dhcp_option::ROUTER: {
+                // Router address.
+                *optp++ = into_raw(opt);
+                *optp++ = 4 /* len */;
+                optp = put_opt_val(optp, pool.gateway);
+            } break;
+
+            case dhcp_option::DNS: {
+                // DNS address.
+                *optp++ = into_raw(opt);
+                *optp++ = 4 /* len */;
+                optp = put_opt_val(optp, pool.dns1);
+            } break;
+
+            case dhcp_option::BROADCAST_ADDR: {
+                // Broadcast address.
+                *optp++ = into_raw(opt);
+                *optp++ = 4 /* len */;
+                optp = put_opt_val(optp, pool.broadcast);
+            } break;
+
+            default:
+                break;
+        }
+    }
+
+    // End option end marker.
+    *optp++ = into_raw(dhcp_option::END);
+
+    const usize reply_len = optp - (u8*)&msg;
+
+    if (resp_msg == dhcp_message_type::DHCP_ACK) {
+        ++counters.acks;
+    } else {
+        ++counters.offers;
+    }
+
+    // Relayed replies are sent to the server port of the relay agent (rfc2131 4.1).
+    if (giaddr != 0) {
+        return dhcp_reply{reply_len, giaddr, DHCP_SERVER_PORT};
+    }
+    // Replies to clients with an address are sent unicast (rfc2131 4.1).
+    if (reply_ciaddr != 0) {
+        return dhcp_reply{reply_len, reply_ciaddr, DHCP_CLIENT_PORT};
+    }
+    return dhcp_reply{reply_len, pool.broadcast, DHCP_CLIENT_PORT};
+}
+
+#undef SERVER_LOG
+
+#endif
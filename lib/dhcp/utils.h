@@ -5,6 +5,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include "types.h"
+
 #include <type_traits>
 
 // Convert from an underlying enum type into an enum variant.
@@ -30,4 +32,51 @@ constexpr u32 hash(const u8* data, usize len) {
     return hash;
 }
 
+// 64 bit keyed hash function, used to fingerprint client identifiers.
+//
+// Consumes 8 bytes per step, each word is mixed with a multiply-rotate-multiply
+// round before it is folded into the state, the state is finalized with the
+// murmur3 fmix64 avalanche. The 'key' should be random per boot, such that
+// colliding client identifiers can't be crafted upfront.
+constexpr u64 hash64(const u8* data, usize len, u64 key) {
+    constexpr u64 C1 = 0x87c37b91114253d5;
+    constexpr u64 C2 = 0x4cf5ad432745937f;
+
+    const auto rotl = [](u64 v, unsigned r) { return (v << r) | (v >> (64 - r)); };
+
+    u64 hash = key ^ (len * 0x9e3779b97f4a7c15);
+    for (usize i = 0; i < len; i += 8) {
+        // Load little endian word, zero padded at the tail.
+        u64 word = 0;
+        for (usize b = 0; b < 8 && i + b < len; ++b) {
+            word |= u64(data[i + b]) << (b * 8);
+        }
+
+        hash ^= rotl(word * C1, 31) * C2;
+        hash = rotl(hash, 27) * 5 + 0x52dce729;
+    }
+
+    // fmix64.
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Try to unwrap an optional, return empty value if optional doesn't hold a value.
+#define TRY(expr)             \
+    ({                        \
+        auto optional = expr; \
+        if (!optional)        \
+            return {};        \
+        optional.value();     \
+    })
+
+// Build an ipv4 address in host byte order, eg ip4(10, 0, 0, 1) = 0x0a000001.
+constexpr u32 ip4(u8 a, u8 b, u8 c, u8 d) {
+    return (u32(a) << 24) | (u32(b) << 16) | (u32(c) << 8) | u32(d);
+}
+
 #endif
@@ -2,30 +2,60 @@
 //
 // Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
 
+#include <config.h>
+#include <ddns.h>
 #include <dhcp.h>
-#include <lease_db.h>
+#include <lease_events.h>
+#include <pcap.h>
+#include <query.h>
+#include <scheduler.h>
+#include <seqlock.h>
+#include <server.h>
 #include <utils.h>
 
 #include <ESP8266WiFi.h>
+#include <LittleFS.h>
 #include <WiFiUdp.h>
 
+/// -- Runtime configuration.
+
+// Configuration file on the LittleFS (see data/dhcp.conf), overrides the
+// defaults (see 'default_config()'). The file is checked periodically for
+// changes and reloaded without loosing leases.
+static constexpr char CONFIG_PATH[] = "/dhcp.conf";
+static constexpr u64 CONFIG_RELOAD_PERIOD_US = 5 * 1000 * 1000;
+
 /// -- WIFI access configuration.
 
 static constexpr char STATION_SSID[] = "<SSID>";
 static constexpr char STATION_WPA2[] = "<WPA2PW>";
 
-/// -- WIFI client config.
+/// -- Packet capture config.
+
+// Number of dhcp messages (received and sent) kept in the capture ring, 0
+// disables capturing. Send 'p' on the serial port to dump the ring.
+static constexpr usize PCAP_SLOTS = 0;
+
+/// -- Maintenance config.
+
+// Time budget per loop iteration for maintenance tasks, only used while no
+// packet is pending.
+static constexpr u64 MAINTENANCE_BUDGET_US = 2000;
+static constexpr u64 FLUSH_EXPIRED_PERIOD_US = 1000 * 1000;
 
-static const IPAddress LOCAL_IP(10, 0, 0, 2);
-static const IPAddress GATEWAY(10, 0, 0, 1);
-static const IPAddress BROADCAST(10, 0, 0, 255);
-static const IPAddress SUBNET(255, 255, 255, 0);
-static const IPAddress DNS1(192, 168, 2, 1);
+/// -- Query config.
 
-/// -- DHCP lease config.
+// Period to publish the server snapshot, send 's' on the serial port to print
+// the last snapshot (counters and leases).
+static constexpr u64 SNAPSHOT_PERIOD_US = 1000 * 1000;
 
-static const IPAddress LEASE_START(10, 0, 0, 10);
-static constexpr u32 LEASE_TIME_SECS = 8 * 60 * 60; /* 8h */
+/// -- Lease event config.
+
+// Number of lease events queued between two runs of the dynamic dns task, and
+// number of addresses whose dns record is tracked.
+static constexpr usize EVENT_SLOTS = 32;
+static constexpr usize DDNS_SLOTS = 32;
+static constexpr u64 DDNS_PERIOD_US = 1000 * 1000;
 
 /// -- DHCP message buffer.
 
@@ -33,29 +63,21 @@ alignas(dhcp_message) static u8 MSG_BUFFER[DHCP_MESSAGE_LEN];
 
 static_assert(sizeof(dhcp_message) <= sizeof(MSG_BUFFER), "UDP buffer must be big enough to hold dhcp_message!");
 
-/// -- Lease DB.
-
-static lease_db<16> LEASE_DB;
-
 /// -- UDP io handler.
 
 static WiFiUDP UDP;
 
-/// -- Template specialization.
+/// -- Maintenance scheduler.
 
-template<>
-inline IPAddress get_opt_val(const u8* opt_data) {
-    return IPAddress(opt_data[0], opt_data[1], opt_data[2], opt_data[3]);
-}
+static scheduler<4> SCHEDULER;
 
-template<>
-inline u8* put_opt_val(u8* opt_data, IPAddress addr) {
-    *opt_data++ = addr[0];
-    *opt_data++ = addr[1];
-    *opt_data++ = addr[2];
-    *opt_data++ = addr[3];
-    return opt_data;
-}
+// Size of a packet detected while running maintenance tasks, which must be
+// handled in the next loop iteration.
+static usize PENDING_BYTES = 0;
+
+/// -- Packet capture ring.
+
+static pcap_ring<PCAP_SLOTS> PCAP;
 
 #define LOG_UART(uart, fmt, ...)                  \
     do {                                          \
@@ -66,24 +88,147 @@ inline u8* put_opt_val(u8* opt_data, IPAddress addr) {
 
 #define LOG(fmt, ...) LOG_UART(Serial, fmt, ##__VA_ARGS__)
 
-static void setup_station_wifi() {
-    // Configure wifi in station mode.
-    WiFi.mode(WIFI_STA);
+// Logger handed to the dhcp server.
+static void log_server(const char* fmt, ...) {
+    if (!Serial) {
+        return;
+    }
+
+    char buf[128];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    Serial.print(buf);
+    Serial.print('\r');
+}
+
+// Convert arduino IPAddress into host byte order address.
+static u32 to_ip4(const IPAddress& addr) {
+    return ip4(addr[0], addr[1], addr[2], addr[3]);
+}
+
+// Convert host byte order address into arduino IPAddress.
+static IPAddress to_ip_address(u32 addr) {
+    return IPAddress(addr >> 24, addr >> 16, addr >> 8, addr);
+}
+
+// Build the configuration from the defaults and the wifi access
+// configuration.
+static server_config target_config() {
+    static_assert(sizeof(STATION_SSID) <= sizeof(server_config::ssid), "SSID too long!");
+    static_assert(sizeof(STATION_WPA2) <= sizeof(server_config::wpa2), "WPA2 password too long!");
+
+    server_config cfg = default_config();
+    std::memcpy(cfg.ssid, STATION_SSID, sizeof(STATION_SSID));
+    std::memcpy(cfg.wpa2, STATION_WPA2, sizeof(STATION_WPA2));
+    return cfg;
+}
+
+// Per boot random key for the client fingerprints, read from the hardware rng.
+static u64 random_key() {
+    return (u64(RANDOM_REG32) << 32) | RANDOM_REG32;
+}
+
+/// -- Lease events.
+
+// Written by the server while handling messages, read by the dynamic dns task.
+static event_ring<EVENT_SLOTS> EVENTS;
+
+static ddns_batcher<DDNS_SLOTS> DDNS;
+
+static WiFiUDP DDNS_UDP;
+
+// Event sink handed to the dhcp server.
+static void queue_event(const lease_event& ev) {
+    EVENTS.push(ev);
+}
+
+/// -- DHCP server.
+
+static constexpr usize LEASES = 16;
+
+static dhcp_server<LEASES> SERVER(target_config(), log_server, random_key(), queue_event);
 
+/// -- Server snapshot.
+
+// Written by the maintenance task, read by the serial query.
+static seqlock<server_snapshot<LEASES>> SNAPSHOT;
+
+/// -- Configuration file.
+
+// Buffer to read the configuration file.
+static char CONFIG_BUFFER[1024];
+static usize CONFIG_LEN = 0;
+
+// Hash of the last loaded configuration file, used to detect changes.
+static u32 CONFIG_HASH = 0;
+
+// Read the configuration file into CONFIG_BUFFER.
+//
+// Return false if the file doesn't exist, is too large or didn't change since
+// the last read.
+static bool read_config() {
+    File file = LittleFS.open(CONFIG_PATH, "r");
+    if (!file) {
+        return false;
+    }
+
+    const usize len = file.read((u8*)CONFIG_BUFFER, sizeof(CONFIG_BUFFER));
+    const bool truncated = file.available() > 0;
+    file.close();
+
+    if (truncated) {
+        LOG("Config %s too large, max %d bytes\n", CONFIG_PATH, sizeof(CONFIG_BUFFER));
+        return false;
+    }
+
+    const u32 h = hash((const u8*)CONFIG_BUFFER, len);
+    if (h == CONFIG_HASH) {
+        return false;
+    }
+    CONFIG_HASH = h;
+    CONFIG_LEN = len;
+    return true;
+}
+
+// Parse the configuration file read by 'read_config'.
+//
+// Return nullopt if the file is malformed.
+static std::optional<server_config> parse_config_buffer() {
+    // Keys not present in the file keep the defaults.
+    usize err_line = 0;
+    const auto cfg = parse_config(CONFIG_BUFFER, CONFIG_LEN, target_config(), &err_line);
+    if (!cfg) {
+        LOG("Config %s malformed at line %d, keep current config\n", CONFIG_PATH, err_line);
+    }
+    return cfg;
+}
+
+static void connect_station_wifi(const server_config& cfg) {
     // Configure static IP.
-    WiFi.config(LOCAL_IP, GATEWAY, SUBNET, DNS1);
+    const pool_config& local = cfg.pools[0];
+    WiFi.config(to_ip_address(cfg.local_ip), to_ip_address(local.gateway), to_ip_address(local.subnet), to_ip_address(local.dns1));
 
     // Connect to SSID.
-    WiFi.begin(STATION_SSID, STATION_WPA2);
+    WiFi.begin(cfg.ssid, cfg.wpa2);
+}
+
+static void setup_station_wifi(const server_config& cfg) {
+    // Configure wifi in station mode.
+    WiFi.mode(WIFI_STA);
+
+    connect_station_wifi(cfg);
 
     // Wait until wifi is connected.
-    Serial.printf("Connecting to SSID = %s\n\r", STATION_SSID);
+    Serial.printf("Connecting to SSID = %s\n\r", cfg.ssid);
     while (WiFi.status() != WL_CONNECTED) {
         Serial.print('.');
         delay(500);
     }
 
-    Serial.printf("\n\rConnected to %s\n\r", STATION_SSID);
+    Serial.printf("\n\rConnected to %s\n\r", cfg.ssid);
     Serial.print("  local_ip : ");
     Serial.println(WiFi.localIP());
     Serial.print("  gateway  : ");
@@ -96,256 +241,222 @@ static void setup_station_wifi() {
     Serial.println(WiFi.broadcastIP());
 }
 
-void setup() {
-    // Initialize serial port for logging.
-    Serial.begin(115200);
+// Steps of the config reload task, each step is a bounded amount of work
+// (see 'task_fn').
+enum class reload_step {
+    // Read the file and check for changes.
+    READ,
+    // Parse the file and apply the configuration.
+    APPLY,
+    // Reconnect wifi with the applied configuration.
+    RECONNECT,
+};
 
-    // Connect as client to wifi using global configuration.
-    setup_station_wifi();
-
-    // Start listening for udp messages.
-    UDP.begin(DHCP_SERVER_PORT);
+static reload_step RELOAD_STEP = reload_step::READ;
 
-    pinMode(LED_BUILTIN, OUTPUT);
-}
+// Run the next step of reloading the configuration file if it changed.
+//
+// Return true if the reload has further steps pending.
+static bool reload_config() {
+    switch (RELOAD_STEP) {
+        case reload_step::READ: {
+            if (!read_config()) {
+                return false;
+            }
+            RELOAD_STEP = reload_step::APPLY;
+            return true;
+        }
 
-static void handle_dhcp_message(dhcp_message& msg, usize len);
+        case reload_step::APPLY: {
+            RELOAD_STEP = reload_step::READ;
 
-void loop() {
-    const usize npbytes = UDP.parsePacket();
+            const auto next = parse_config_buffer();
+            if (!next) {
+                return false;
+            }
 
-    // Only handle UDP packets with valid size wrt dhcp messages.
-    if (npbytes >= DHCP_MESSAGE_MIN_LEN && npbytes < sizeof(dhcp_message)) {
-        const usize nrbytes = UDP.read(MSG_BUFFER, npbytes);
+            const server_config curr = SERVER.config();
+            if (!SERVER.reconfigure(next.value())) {
+                LOG("Config %s has overlapping pools or invalid lease ranges, keep current config\n", CONFIG_PATH);
+                return false;
+            }
+            LOG("Reloaded config %s\n", CONFIG_PATH);
+
+            // Reconnect wifi if the client configuration changed.
+            const pool_config& curr_local = curr.pools[0];
+            const pool_config& next_local = next->pools[0];
+            if (curr.local_ip != next->local_ip || curr_local.gateway != next_local.gateway || curr_local.subnet != next_local.subnet ||
+                curr_local.dns1 != next_local.dns1 || std::strcmp(curr.ssid, next->ssid) != 0 || std::strcmp(curr.wpa2, next->wpa2) != 0) {
+                RELOAD_STEP = reload_step::RECONNECT;
+                return true;
+            }
+            return false;
+        }
 
-        // Type pun buffer to to dhcp_message (cpp).
-        // Should be optimized out mainly due to alignment specification of buffer.
-        dhcp_message msg;
-        std::memcpy(&msg, MSG_BUFFER, sizeof(msg));
+        case reload_step::RECONNECT: {
+            RELOAD_STEP = reload_step::READ;
 
-        handle_dhcp_message(msg, nrbytes);
-    } else {
-        if (npbytes > 0) {
-            LOG("Ignored UDP message of size %d bytes\n", npbytes);
+            const server_config& cfg = SERVER.config();
+            LOG("Reconnect to SSID = %s\n", cfg.ssid);
+            connect_station_wifi(cfg);
+            return false;
         }
-        delay(500);
     }
+    return false;
 }
 
-// Try to unwrap an optional, return of optional doesn't hold a value.
-#define TRY(expr)             \
-    ({                        \
-        auto optional = expr; \
-        if (!optional)        \
-            return;           \
-        optional.value();     \
-    })
+// Convert the time since boot 'now_us' into seconds (absolute time value).
+//
+// The packet path and the maintenance tasks must use the same clock for the
+// lease expiration times, 'micros64()' doesn't wrap unlike 'millis()' which
+// wraps after ~49.7 days.
+static usize to_secs(u64 now_us) {
+    return now_us / 1000000;
+}
 
 // Get seconds since boot (absolute time value).
 // We use this to maintain lease expiration times.
-usize now_secs() {
-    return millis() / 1000;
+static usize now_secs() {
+    return to_secs(micros64());
 }
 
-static void handle_dhcp_message(dhcp_message& msg, usize len) {
-    // Sanity check dhcp message.
-    if (msg.op != dhcp_operation::BOOTREQUEST || msg.cookie != DHCP_OPTION_COOKIE) {
-        return;
-    }
-
-    // Length of the filled in client options.
-    const usize opt_len = len - (msg.options - (const u8*)&msg);
-
-    // Each dhcp message must contain the dhcp message type (state in the protocol).
-    const auto msg_type = ({
-        auto opt = TRY(get_option(msg.options, opt_len, dhcp_option::DHCP_MESSAGE_TYPE));
-        from_raw<dhcp_message_type>(opt.data[0]);
-    });
-
-    // Remove expired leases.
-    LEASE_DB.flush_expired(now_secs());
-
-    // Compute client hash, using the CLIENT_ID option if available else use
-    // the hardware address.
-    u32 client_hash;
-    if (const auto client_id = get_option(msg.options, opt_len, dhcp_option::CLIENT_ID)) {
-        client_hash = hash(client_id->data, client_id->len);
-    } else {
-        client_hash = hash(msg.chaddr, msg.hlen);
-    }
-
-    // Extract the dhcp options requested by the client (using 16 was sufficient in my case).
-    dhcp_option requested_param[16];
-    usize requested_param_len = 0;
-    if (const auto opt = get_option(msg.options, opt_len, dhcp_option::PARAMETER_REQUEST_LIST)) {
-        requested_param_len = opt->len > sizeof(requested_param) ? sizeof(requested_param) : opt->len;
+void setup() {
+    // Initialize serial port for logging.
+    Serial.begin(115200);
 
-        for (usize i = 0; i < requested_param_len; ++i) {
-            requested_param[i] = from_raw<dhcp_option>(opt->data[i]);
+    // Load the configuration file if there is one.
+    if (!LittleFS.begin()) {
+        LOG("Failed to mount LittleFS, use default config\n");
+    } else if (read_config()) {
+        const auto cfg = parse_config_buffer();
+        if (cfg && !SERVER.reconfigure(cfg.value())) {
+            LOG("Config %s has overlapping pools or invalid lease ranges, keep current config\n", CONFIG_PATH);
         }
     }
 
-    usize lease_id;
-    dhcp_message_type resp_msg;
-
-    switch (msg_type) {
-        case dhcp_message_type::DHCP_DISCOVER: {
-            LOG("Received DHCP_DISCOVER client_hash=%x\n", client_hash);
-
-            if (const auto lease = LEASE_DB.get_lease(client_hash)) {
-                // We already have a lease for this client.
-                lease_id = lease.value();
-            } else {
-                // Allocate a new lease for this client and reserve for a short
-                // amount of time.
-                lease_id = TRY(LEASE_DB.new_lease(client_hash, now_secs() + 15 /* secs */));
-            }
+    // Connect as client to wifi using the configuration.
+    setup_station_wifi(SERVER.config());
 
-            // DHCP message type answer.
-            resp_msg = dhcp_message_type::DHCP_OFFER;
-        } break;
+    // Start listening for udp messages.
+    UDP.begin(DHCP_SERVER_PORT);
 
-        case dhcp_message_type::DHCP_REQUEST: {
-            LOG("Received DHCP_REQUEST client_hash=%x\n", client_hash);
+    pinMode(LED_BUILTIN, OUTPUT);
 
-            // Get server identifier specified by client.
-            const auto server_id = ({
-                auto op = TRY(get_option(msg.options, opt_len, dhcp_option::SERVER_IDENTIFIER));
-                get_opt_val<IPAddress>(op.data);
+    // Register maintenance tasks.
+    SCHEDULER.add(
+        [](u64 now_us) {
+            SERVER.flush_expired(to_secs(now_us));
+            return false;
+        },
+        FLUSH_EXPIRED_PERIOD_US);
+    SCHEDULER.add([](u64) { return reload_config(); }, CONFIG_RELOAD_PERIOD_US);
+    SCHEDULER.add(
+        [](u64 now_us) {
+            SNAPSHOT.write([&](server_snapshot<LEASES>& snap) { SERVER.snapshot(snap, to_secs(now_us)); });
+            return false;
+        },
+        SNAPSHOT_PERIOD_US);
+    SCHEDULER.add(
+        [](u64 now_us) {
+            const ddns_config cfg = SERVER.config().ddns;
+            DDNS.drain(EVENTS, cfg, to_secs(now_us), [&](const u8* msg, usize len) {
+                DDNS_UDP.beginPacket(to_ip_address(cfg.server), cfg.port);
+                DDNS_UDP.write(msg, len);
+                DDNS_UDP.endPacket();
             });
+            return false;
+        },
+        DDNS_PERIOD_US);
+}
 
-            // Check if dhcp message was ment for us.
-            if (server_id != LOCAL_IP) {
-                return;
+// Dump the capture ring as hex encoded pcap file on the serial port.
+// Convert on the host with: xxd -r -p dump.txt dump.pcap
+static void dump_pcap() {
+    usize col = 0;
+    PCAP.dump([&](const u8* data, usize len) {
+        for (usize i = 0; i < len; ++i) {
+            Serial.printf("%02x", data[i]);
+            if (++col % 32 == 0) {
+                Serial.print("\n\r");
             }
+        }
+    });
+    Serial.print("\n\r");
+}
 
-            // Client is now requesting the offered lease, at that stage the
-            // lease should have been allocated.
-            lease_id = TRY(LEASE_DB.get_lease(client_hash));
+// Print the last published server snapshot on the serial port.
+static void print_snapshot() {
+    static server_snapshot<LEASES> snap;
+    SNAPSHOT.read(snap);
 
-            // Update the lease db with the proper lease expiration time
-            // (absolute time).
-            LEASE_DB.update_lease(client_hash, now_secs() + LEASE_TIME_SECS /* secs */);
+    format_snapshot(snap, [](const char* str, usize len) {
+        Serial.write(str, len);
+        Serial.print('\r');
+    });
+}
 
-            // DHCP message type answer.
-            resp_msg = dhcp_message_type::DHCP_ACK;
-        } break;
+static void handle_dhcp_message(dhcp_message& msg, usize len) {
+    if constexpr (PCAP_SLOTS > 0) {
+        PCAP.push({micros64(), to_ip4(UDP.remoteIP()), to_ip4(UDP.destinationIP()), UDP.remotePort(), DHCP_SERVER_PORT,
+                   (const u8*)&msg, len});
+    }
 
-        default: {
-            LOG("Received unexpected DHCP MESSAGE TYPE %d\n", into_raw(msg_type));
-            return;
-        }
+    const auto reply = SERVER.handle_dhcp_message(msg, len, now_secs());
+    if (!reply) {
+        return;
     }
 
-    // Craft response package.
-
-    // Compute client id based on start address of dhcp range and lease idx.
-    auto client_addr = LEASE_START;
-    client_addr[3] = client_addr[3] + lease_id;
-
-    // From rfc2131 Table 3:
-    //
-    // Field      DHCPOFFER   DHCPACK
-    // -----      ---------   -------
-    // 'op'       BOOTREPLY   BOOTREPLY
-    // 'htype'    keep        keep
-    // 'hlen'     keep        keep
-    // 'hops'     0           0
-    // 'xid'      keep        keep
-    // 'secs'     0           0
-    // 'ciaddr'   0           0
-    // 'yiaddr'   IP address offered to client
-    // 'siaddr'   IP address of next bootstrap server
-    // 'flags'    keep        keep
-    // 'giaddr'   keep        keep
-    // 'chaddr'   keep        keep
-    // 'sname'    Server host name or options
-    // 'file'     Client boot file name or options
-
-    msg.op = dhcp_operation::BOOTREPLY;
-    msg.hops = 0;
-    msg.secs = 0;
-    msg.ciaddr = 0;
-    msg.yiaddr = client_addr.v4();
-    msg.siaddr = LOCAL_IP.v4();
-
-    // From rfc2131 Table 3:
-    //
-    // Option                    DHCPOFFER   DHCPACK
-    // ------                    ---------   -------
-    // IP address lease time     MUST        MUST (DHCPREQUEST)
-    // DHCP message type         DHCPOFFER   DHCPACK
-    // Server identifier         MUST        MUST
-
-    u8* optp = msg.options;
-
-    // DHCP message type.
-    *optp++ = into_raw(dhcp_option::DHCP_MESSAGE_TYPE);
-    *optp++ = 1 /* len */;
-    *optp++ = into_raw(resp_msg);
-
-    // Server identifier.
-    *optp++ = into_raw(dhcp_option::SERVER_IDENTIFIER);
-    *optp++ = 4 /* len */;
-    optp = put_opt_val(optp, LOCAL_IP);
-
-    // Lease time.
-    *optp++ = into_raw(dhcp_option::IP_ADDRESS_LEASE_TIME);
-    *optp++ = 4 /* len */;
-    optp = put_opt_val(optp, LEASE_TIME_SECS);
-
-    // Renewal time.
-    *optp++ = into_raw(dhcp_option::RENEWAL_TIME_T1);
-    *optp++ = 4 /* len */;
-    optp = put_opt_val(optp, LEASE_TIME_SECS / 2);
-
-    // Rebind time.
-    *optp++ = into_raw(dhcp_option::REBINDING_TIME_T2);
-    *optp++ = 4 /* len */;
-    optp = put_opt_val(optp, LEASE_TIME_SECS * 8 / 12);
-
-    // Add options requested by client that we support.
-    for (usize i = 0; i < requested_param_len; ++i) {
-        auto opt = requested_param[i];
-        switch (opt) {
-            case dhcp_option::SUBNET_MASK: {
-                // Subnet mask.
-                *optp++ = into_raw(opt);
-                *optp++ = 4 /* len */;
-                optp = put_opt_val(optp, SUBNET);
-            } break;
-
-            case dhcp_option::ROUTER: {
-                // Router address.
-                *optp++ = into_raw(opt);
-                *optp++ = 4 /* len */;
-                optp = put_opt_val(optp, GATEWAY);
-            } break;
-
-            case dhcp_option::DNS: {
-                // DNS address.
-                *optp++ = into_raw(opt);
-                *optp++ = 4 /* len */;
-                optp = put_opt_val(optp, DNS1);
-            } break;
-
-            case dhcp_option::BROADCAST_ADDR: {
-                // Broadcast address.
-                *optp++ = into_raw(opt);
-                *optp++ = 4 /* len */;
-                optp = put_opt_val(optp, BROADCAST);
-            } break;
+    if constexpr (PCAP_SLOTS > 0) {
+        PCAP.push({micros64(), SERVER.config().local_ip, reply->dst, DHCP_SERVER_PORT, reply->port, (const u8*)&msg, reply->len});
+    }
 
+    // Send out dhcp message.
+    UDP.beginPacket(to_ip_address(reply->dst), reply->port);
+    UDP.write((const u8*)&msg, reply->len);
+    UDP.endPacket();
+}
+
+void loop() {
+    // Serial commands.
+    if (Serial.available()) {
+        switch (Serial.read()) {
+            case 'p':
+                if constexpr (PCAP_SLOTS > 0) {
+                    dump_pcap();
+                }
+                break;
+            case 's':
+                print_snapshot();
+                break;
             default:
                 break;
         }
     }
 
-    // End option end marker.
-    *optp++ = into_raw(dhcp_option::END);
+    // Packet may already be parsed while running maintenance tasks.
+    const usize npbytes = PENDING_BYTES ? PENDING_BYTES : UDP.parsePacket();
+    PENDING_BYTES = 0;
 
-    // Send out dhcp message.
-    UDP.beginPacket(BROADCAST, DHCP_CLIENT_PORT);
-    UDP.write((const u8*)&msg, optp - (u8*)&msg);
-    UDP.endPacket();
+    // Only handle UDP packets with valid size wrt dhcp messages.
+    if (npbytes >= DHCP_MESSAGE_MIN_LEN && npbytes < sizeof(dhcp_message)) {
+        const usize nrbytes = UDP.read(MSG_BUFFER, npbytes);
+
+        // Type pun buffer to to dhcp_message (cpp).
+        // Should be optimized out mainly due to alignment specification of buffer.
+        dhcp_message msg;
+        std::memcpy(&msg, MSG_BUFFER, sizeof(msg));
+
+        handle_dhcp_message(msg, nrbytes);
+    } else {
+        if (npbytes > 0) {
+            LOG("Ignored UDP message of size %d bytes\n", npbytes);
+        }
+
+        // Run maintenance tasks while idle, preempt as soon as a packet arrives.
+        SCHEDULER.run(micros64, [] { return (PENDING_BYTES = UDP.parsePacket()) > 0; }, MAINTENANCE_BUDGET_US);
+
+        if (PENDING_BYTES == 0) {
+            delay(500);
+        }
+    }
 }
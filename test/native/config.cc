@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include "fixture.h"
+
+#include <config.h>
+#include <utils.h>
+
+#include <cstring>
+#include <gtest/gtest.h>
+
+static std::optional<server_config> parse(const char* text, usize* err_line = nullptr) {
+    return parse_config(text, std::strlen(text), TEST_CONFIG, err_line);
+}
+
+TEST(config, parse_ip4) {
+    const char* ok = "192.168.2.1";
+    ASSERT_EQ(std::optional(ip4(192, 168, 2, 1)), parse_ip4(ok, std::strlen(ok)));
+
+    for (const char* bad : {"", "1.2.3", "1.2.3.4.5", "256.0.0.1", "1..2.3", "1.2.3.4.", "a.b.c.d", "1234.0.0.1"}) {
+        ASSERT_EQ(std::nullopt, parse_ip4(bad, std::strlen(bad))) << bad;
+    }
+}
+
+TEST(config, parse_empty) {
+    const auto cfg = parse("");
+    ASSERT_EQ(true, cfg.has_value());
+    ASSERT_EQ(TEST_CONFIG.local_ip, cfg->local_ip);
+    ASSERT_EQ(TEST_POOL.lease_time_secs, cfg->pools[0].lease_time_secs);
+    ASSERT_EQ(1, cfg->npools);
+}
+
+TEST(config, parse_all) {
+    const auto cfg = parse(
+        "# dhcp server config\n"
+        "local_ip    = 10.1.0.2\n"
+        "gateway     = 10.1.0.1\n"
+        "broadcast   = 10.1.0.255\n"
+        "subnet      = 255.255.0.0\n"
+        "\n"
+        "dns1        = 1.1.1.1\r\n"
+        "lease_start = 10.1.0.100\n"
+        "lease_time  = 3600\n"
+        "lease_time_min = 600\n"
+        "rapid_commit = 1\n"
+        "ssid        = guest wifi\n"
+        "wpa2        = secret");
+
+    ASSERT_EQ(true, cfg.has_value());
+    ASSERT_EQ(ip4(10, 1, 0, 2), cfg->local_ip);
+    ASSERT_EQ(ip4(10, 1, 0, 1), cfg->pools[0].gateway);
+    ASSERT_EQ(ip4(10, 1, 0, 255), cfg->pools[0].broadcast);
+    ASSERT_EQ(ip4(255, 255, 0, 0), cfg->pools[0].subnet);
+    ASSERT_EQ(ip4(1, 1, 1, 1), cfg->pools[0].dns1);
+    ASSERT_EQ(ip4(10, 1, 0, 100), cfg->pools[0].lease_start);
+    ASSERT_EQ(3600, cfg->pools[0].lease_time_secs);
+    ASSERT_EQ(600, cfg->pools[0].lease_time_min_secs);
+    ASSERT_EQ(true, cfg->rapid_commit);
+    ASSERT_STREQ("guest wifi", cfg->ssid);
+    ASSERT_STREQ("secret", cfg->wpa2);
+}
+
+TEST(config, parse_errors) {
+    usize line = 0;
+
+    ASSERT_EQ(false, parse("gateway = 10.0.0.1\nfoo = 1\n", &line).has_value());
+    ASSERT_EQ(2, line);
+
+    ASSERT_EQ(false, parse("\n\ngateway 10.0.0.1\n", &line).has_value());
+    ASSERT_EQ(3, line);
+
+    ASSERT_EQ(false, parse("lease_time = 0\n", &line).has_value());
+    ASSERT_EQ(1, line);
+
+    ASSERT_EQ(false, parse("lease_time = 31536001\n", &line).has_value());
+    ASSERT_EQ(1, line);
+
+    ASSERT_EQ(false, parse("ssid = 012345678901234567890123456789012\n", &line).has_value());
+    ASSERT_EQ(1, line);
+
+    ASSERT_EQ(false, parse("rapid_commit = yes\n", &line).has_value());
+    ASSERT_EQ(1, line);
+
+    ASSERT_EQ(false, parse("lease_time = 600\nlease_time_min = 900\n", &line).has_value());
+    ASSERT_EQ(2, line);
+
+    for (const char* bad : {"ddns_zone = \n", "ddns_zone = .\n", "ddns_zone = a..lan\n", "ddns_zone = my_lan\n", "ddns_port = 0\n",
+                            "ddns_port = 65536\n", "ddns_server = lan\n"}) {
+        ASSERT_EQ(false, parse(bad, &line).has_value()) << bad;
+        ASSERT_EQ(1, line);
+    }
+}
+
+TEST(config, find_invalid_pool) {
+    ASSERT_EQ(std::nullopt, find_invalid_pool(TEST_CONFIG, 16));
+    // Up to the last host address of the network.
+    ASSERT_EQ(std::nullopt, find_invalid_pool(TEST_CONFIG, 245));
+
+    // Range exceeds the network, includes the broadcast address.
+    ASSERT_EQ(std::optional<usize>(0), find_invalid_pool(TEST_CONFIG, 246));
+
+    server_config cfg = TEST_CONFIG;
+    cfg.pools[0].lease_start = ip4(10, 0, 0, 250);
+    ASSERT_EQ(std::optional<usize>(0), find_invalid_pool(cfg, 16));
+
+    // Network address.
+    cfg.pools[0].lease_start = ip4(10, 0, 0, 0);
+    ASSERT_EQ(std::optional<usize>(0), find_invalid_pool(cfg, 1));
+
+    // Range includes the gateway or the local address.
+    cfg.pools[0].lease_start = ip4(10, 0, 0, 1);
+    ASSERT_EQ(std::optional<usize>(0), find_invalid_pool(cfg, 1));
+    cfg.pools[0].lease_start = ip4(10, 0, 0, 2);
+    ASSERT_EQ(std::optional<usize>(0), find_invalid_pool(cfg, 1));
+    cfg.pools[0].lease_start = ip4(10, 0, 0, 3);
+    ASSERT_EQ(std::nullopt, find_invalid_pool(cfg, 1));
+
+    // Relay pools are checked the same way.
+    const auto relay = parse("[pool]\nlease_start = 10.1.0.250\ngateway = 10.1.0.1\n");
+    ASSERT_EQ(true, relay.has_value());
+    ASSERT_EQ(std::nullopt, find_invalid_pool(relay.value(), 5));
+    ASSERT_EQ(std::optional<usize>(1), find_invalid_pool(relay.value(), 16));
+}
+
+TEST(config, parse_ddns) {
+    const auto cfg = parse(
+        "ddns_server = 10.0.0.3\n"
+        "ddns_port   = 5353\n"
+        "ddns_ttl    = 600\n"
+        "ddns_zone   = home.arpa.\n");
+    ASSERT_EQ(true, cfg.has_value());
+    ASSERT_EQ(ip4(10, 0, 0, 3), cfg->ddns.server);
+    ASSERT_EQ(5353, cfg->ddns.port);
+    ASSERT_EQ(600, cfg->ddns.ttl);
+    ASSERT_STREQ("home.arpa", cfg->ddns.zone);
+
+    // Not set keys keep the base values.
+    ASSERT_EQ(TEST_CONFIG.ddns.server, parse("ddns_zone = lan\n")->ddns.server);
+}
+
+TEST(config, parse_pools) {
+    const auto cfg = parse(
+        "lease_time  = 3600\n"
+        "\n"
+        "[pool]\n"
+        "lease_start = 10.1.0.10\n"
+        "gateway     = 10.1.0.1\n"
+        "\n"
+        "[pool]\n"
+        "lease_start = 172.16.0.100\n"
+        "subnet      = 255.255.0.0\n"
+        "gateway     = 172.16.0.1\n"
+        "dns1        = 1.1.1.1\n"
+        "lease_time  = 60\n");
+
+    ASSERT_EQ(true, cfg.has_value());
+    ASSERT_EQ(3, cfg->npools);
+    ASSERT_EQ(3600, cfg->pools[0].lease_time_secs);
+
+    // Defaults from the local pool, broadcast derived.
+    ASSERT_EQ(ip4(10, 1, 0, 10), cfg->pools[1].lease_start);
+    ASSERT_EQ(ip4(255, 255, 255, 0), cfg->pools[1].subnet);
+    ASSERT_EQ(ip4(10, 1, 0, 1), cfg->pools[1].gateway);
+    ASSERT_EQ(ip4(10, 1, 0, 255), cfg->pools[1].broadcast);
+    ASSERT_EQ(TEST_POOL.dns1, cfg->pools[1].dns1);
+    ASSERT_EQ(3600, cfg->pools[1].lease_time_secs);
+
+    ASSERT_EQ(ip4(172, 16, 0, 100), cfg->pools[2].lease_start);
+    ASSERT_EQ(ip4(255, 255, 0, 0), cfg->pools[2].subnet);
+    ASSERT_EQ(ip4(172, 16, 255, 255), cfg->pools[2].broadcast);
+    ASSERT_EQ(ip4(1, 1, 1, 1), cfg->pools[2].dns1);
+    ASSERT_EQ(60, cfg->pools[2].lease_time_secs);
+}
+
+TEST(config, parse_pool_errors) {
+    usize line = 0;
+
+    // Missing gateway.
+    ASSERT_EQ(false, parse("[pool]\nlease_start = 10.1.0.10\n", &line).has_value());
+    ASSERT_EQ(1, line);
+
+    // Minimal lease time above the lease time.
+    ASSERT_EQ(false, parse("[pool]\nlease_start = 10.1.0.10\ngateway = 10.1.0.1\nlease_time_min = 99999\n", &line).has_value());
+    ASSERT_EQ(1, line);
+
+    // Server keys are not allowed in pool sections.
+    ASSERT_EQ(false, parse("[pool]\nlease_start = 10.1.0.10\nssid = foo\n", &line).has_value());
+    ASSERT_EQ(3, line);
+
+    // Overlaps with the local pool.
+    ASSERT_EQ(false, parse("[pool]\nlease_start = 10.0.0.100\ngateway = 10.0.0.1\n", &line).has_value());
+    ASSERT_EQ(1, line);
+
+    // Too many pools.
+    std::string text;
+    for (usize p = 0; p < CONFIG_MAX_POOLS; ++p) {
+        text += "[pool]\nlease_start = 10.1." + std::to_string(p) + ".10\ngateway = 10.1." + std::to_string(p) + ".1\n";
+    }
+    ASSERT_EQ(false, parse(text.c_str(), &line).has_value());
+    ASSERT_EQ(3 * CONFIG_MAX_POOLS - 2, line);
+}
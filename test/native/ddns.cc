@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include "fixture.h"
+
+#include <ddns.h>
+#include <server.h>
+#include <utils.h>
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <vector>
+
+static constexpr ddns_config DDNS = {
+    ip4(10, 0, 0, 3),   // server
+    DDNS_DEFAULT_PORT,  // port
+    300,                // ttl
+    "lan",              // zone
+};
+
+static constexpr server_config CONFIG = [] {
+    server_config cfg = TEST_CONFIG;
+    cfg.ddns = DDNS;
+    return cfg;
+}();
+
+static lease_event make_event(lease_event_type type, u32 addr, const char* hostname = "") {
+    lease_event ev = {type, 1, addr, 0, ""};
+    std::strncpy(ev.hostname, hostname, LEASE_EVENT_HOSTNAME_LEN);
+    return ev;
+}
+
+// Header of an update message of the zone 'lan' with 'updates' updates.
+static std::vector<u8> header(u16 id, u8 updates) {
+    return {
+        0, u8(id), 0x28, 0, 0, 1, 0, 0, 0, updates, 0, 0,  // header, opcode UPDATE
+        3, 'l', 'a', 'n', 0, 0, 6, 0, 1,                  // zone lan SOA IN
+    };
+}
+
+static void delete_rr(std::vector<u8>& msg, const char* label) {
+    msg.push_back(std::strlen(label));
+    msg.insert(msg.end(), label, label + std::strlen(label));
+    msg.insert(msg.end(), {0xc0, 0x0c, 0, 1, 0, 255, 0, 0, 0, 0, 0, 0});  // A ANY ttl 0 rdlen 0
+}
+
+static void remove_rr(std::vector<u8>& msg, const char* label, u8 host) {
+    msg.push_back(std::strlen(label));
+    msg.insert(msg.end(), label, label + std::strlen(label));
+    msg.insert(msg.end(), {0xc0, 0x0c, 0, 1, 0, 254, 0, 0, 0, 0, 0, 4, 10, 0, 0, host});  // A NONE ttl 0 10.0.0.x
+}
+
+static void add_rr(std::vector<u8>& msg, const char* label, u8 host) {
+    msg.push_back(std::strlen(label));
+    msg.insert(msg.end(), label, label + std::strlen(label));
+    msg.insert(msg.end(), {0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 1, 0x2c, 0, 4, 10, 0, 0, host});  // A IN ttl 300 10.0.0.x
+}
+
+static std::vector<u8> flush(ddns_batcher<4>& batcher, usize now_secs) {
+    u8 buf[DDNS_MESSAGE_LEN];
+    const usize len = batcher.flush(buf, sizeof(buf), DDNS, now_secs);
+    return {buf, buf + len};
+}
+
+TEST(ddns, label) {
+    char label[LEASE_EVENT_HOSTNAME_LEN + 1];
+
+    ASSERT_EQ(6, ddns_label("Laptop", label));
+    ASSERT_STREQ("laptop", label);
+
+    ASSERT_EQ(8, ddns_label("my_phone.example.com", label));
+    ASSERT_STREQ("my-phone", label);
+
+    ASSERT_EQ(4, ddns_label("--tv 2--", label));
+    ASSERT_STREQ("tv-2", label);
+
+    ASSERT_EQ(0, ddns_label("", label));
+    ASSERT_EQ(0, ddns_label("_.lan", label));
+    ASSERT_STREQ("", label);
+}
+
+TEST(ddns, message) {
+    u8 buf[DDNS_MESSAGE_LEN];
+    ddns_message msg(buf, sizeof(buf), 7, "lan");
+
+    ASSERT_EQ(true, msg.delete_a("pc"));
+    ASSERT_EQ(true, msg.add_a("pc", ip4(10, 0, 0, 10), 300));
+    ASSERT_EQ(2, msg.updates());
+
+    std::vector<u8> expect = header(7, 2);
+    delete_rr(expect, "pc");
+    add_rr(expect, "pc", 10);
+    ASSERT_EQ(expect, std::vector<u8>(buf, buf + msg.len()));
+
+    // Updates which don't fit are not appended.
+    ddns_message small(buf, header(1, 0).size() + 16, 1, "lan");
+    ASSERT_EQ(true, small.delete_a("pc"));
+    ASSERT_EQ(false, small.add_a("pc", ip4(10, 0, 0, 10), 300));
+    ASSERT_EQ(1, small.updates());
+    ASSERT_EQ(header(1, 0).size() + 15, small.len());
+
+    // Zone doesn't fit.
+    ddns_message none(buf, 8, 1, "lan");
+    ASSERT_EQ(0, none.len());
+    ASSERT_EQ(false, none.delete_a("pc"));
+}
+
+TEST(ddns, renew_storm) {
+    ddns_batcher<4> batcher;
+
+    ASSERT_EQ(true, batcher.add(make_event(lease_event_type::NEW, ip4(10, 0, 0, 10), "pc"), 0));
+    for (usize n = 0; n < 1000; ++n) {
+        ASSERT_EQ(true, batcher.add(make_event(lease_event_type::RENEW, ip4(10, 0, 0, 10), n % 2 ? "pc" : ""), 1));
+    }
+    ASSERT_EQ(1, batcher.pending());
+
+    // Held back for the batch delay.
+    ASSERT_EQ(0, flush(batcher, DDNS_BATCH_DELAY_SECS - 1).size());
+
+    std::vector<u8> expect = header(1, 2);
+    delete_rr(expect, "pc");
+    add_rr(expect, "pc", 10);
+    ASSERT_EQ(expect, flush(batcher, DDNS_BATCH_DELAY_SECS));
+    ASSERT_EQ(0, batcher.pending());
+
+    // Renewals of the published name are no change.
+    for (usize n = 0; n < 1000; ++n) {
+        ASSERT_EQ(true, batcher.add(make_event(lease_event_type::RENEW, ip4(10, 0, 0, 10), "PC"), 10));
+    }
+    ASSERT_EQ(0, batcher.pending());
+    ASSERT_EQ(0, flush(batcher, 100).size());
+}
+
+TEST(ddns, rename_expire) {
+    ddns_batcher<4> batcher;
+
+    batcher.add(make_event(lease_event_type::NEW, ip4(10, 0, 0, 10), "pc"), 0);
+    ASSERT_EQ(2, flush(batcher, 10)[9]);
+
+    // New name, the old record is removed.
+    batcher.add(make_event(lease_event_type::RENEW, ip4(10, 0, 0, 10), "desktop"), 20);
+    std::vector<u8> expect = header(2, 3);
+    remove_rr(expect, "pc", 10);
+    delete_rr(expect, "desktop");
+    add_rr(expect, "desktop", 10);
+    ASSERT_EQ(expect, flush(batcher, 30));
+
+    batcher.add(make_event(lease_event_type::EXPIRE, ip4(10, 0, 0, 10)), 40);
+    // Only the record of the address is removed, another client with the same
+    // name may hold the name by now.
+    expect = header(3, 1);
+    remove_rr(expect, "desktop", 10);
+    ASSERT_EQ(expect, flush(batcher, 50));
+
+    // Leases without host name and expiries of unpublished names are no change.
+    batcher.add(make_event(lease_event_type::NEW, ip4(10, 0, 0, 11)), 60);
+    batcher.add(make_event(lease_event_type::EXPIRE, ip4(10, 0, 0, 12)), 60);
+    batcher.add(make_event(lease_event_type::NEW, ip4(10, 0, 0, 13), "tv"), 60);
+    batcher.add(make_event(lease_event_type::EXPIRE, ip4(10, 0, 0, 13)), 60);
+    ASSERT_EQ(0, batcher.pending());
+    ASSERT_EQ(0, flush(batcher, 100).size());
+}
+
+TEST(ddns, batch_split) {
+    ddns_batcher<4> batcher;
+
+    for (u8 h = 10; h < 14; ++h) {
+        char name[] = "host-x";
+        name[5] = 'a' + h - 10;
+        ASSERT_EQ(true, batcher.add(make_event(lease_event_type::NEW, ip4(10, 0, 0, h), name), 0));
+    }
+    // All slots in use.
+    ASSERT_EQ(false, batcher.add(make_event(lease_event_type::NEW, ip4(10, 0, 0, 14), "host-e"), 0));
+    ASSERT_EQ(4, batcher.pending());
+
+    // Each change is 42 bytes, three fit after header and zone.
+    u8 buf[21 + 3 * 42 + 10];
+    usize len = batcher.flush(buf, sizeof(buf), DDNS, 0, true /* force */);
+    ASSERT_EQ(21 + 3 * 42, len);
+    ASSERT_EQ(6, buf[9]);
+    ASSERT_EQ(1, batcher.pending());
+
+    len = batcher.flush(buf, sizeof(buf), DDNS, 0, true /* force */);
+    ASSERT_EQ(21 + 42, len);
+    ASSERT_EQ(0, batcher.pending());
+}
+
+TEST(ddns, drain) {
+    event_ring<8> ring;
+    ddns_batcher<4> batcher;
+    usize msgs = 0;
+    const auto send = [&](const u8*, usize) { ++msgs; };
+
+    // Disabled, events are discarded.
+    ddns_config off = DDNS;
+    off.server = 0;
+    ring.push(make_event(lease_event_type::NEW, ip4(10, 0, 0, 10), "pc"));
+    ASSERT_EQ(0, batcher.drain(ring, off, 0, send));
+    ASSERT_EQ(std::nullopt, ring.pop());
+    ASSERT_EQ(0, batcher.pending());
+
+    ring.push(make_event(lease_event_type::NEW, ip4(10, 0, 0, 10), "pc"));
+    ASSERT_EQ(0, batcher.drain(ring, DDNS, 0, send));
+    ASSERT_EQ(1, batcher.pending());
+    ASSERT_EQ(1, batcher.drain(ring, DDNS, DDNS_BATCH_DELAY_SECS, send));
+    ASSERT_EQ(1, msgs);
+
+    // Out of slots, deletions are sent right away to free their slots.
+    for (u8 h = 11; h < 14; ++h) {
+        ring.push(make_event(lease_event_type::NEW, ip4(10, 0, 0, h), "tv"));
+    }
+    ring.push(make_event(lease_event_type::EXPIRE, ip4(10, 0, 0, 10)));
+    ring.push(make_event(lease_event_type::NEW, ip4(10, 0, 0, 14), "tv"));
+    ASSERT_EQ(1, batcher.drain(ring, DDNS, 10, send));
+    ASSERT_EQ(0, batcher.dropped());
+    ASSERT_EQ(1, batcher.pending());
+
+    ring.push(make_event(lease_event_type::NEW, ip4(10, 0, 0, 15), "tv"));
+    batcher.drain(ring, DDNS, 20, send);
+    ASSERT_EQ(1, batcher.dropped());
+}
+
+// Events raised by the server under test.
+static event_ring<64> EVENTS;
+
+static void queue_event(const lease_event& ev) {
+    EVENTS.push(ev);
+}
+
+TEST(ddns, server_renew_storm) {
+    dhcp_server<4> srv(CONFIG, nullptr, 1, queue_event);
+    ddns_batcher<4> batcher;
+    dhcp_message msg;
+    usize msgs = 0;
+    const auto send = [&](const u8*, usize) { ++msgs; };
+
+    // Client request with host name 'tv'.
+    const auto request = [&](dhcp_message_type type, u8 mac) {
+        return srv.handle_dhcp_message(msg, make_request(msg, type, mac, "tv"), 0).has_value();
+    };
+
+    // A misbehaving client renews in a tight loop, the maintenance task drains
+    // the events once per second.
+    ASSERT_EQ(true, request(dhcp_message_type::DHCP_DISCOVER, 1));
+    for (usize secs = 0; secs < 10; ++secs) {
+        for (usize n = 0; n < 50; ++n) {
+            ASSERT_EQ(true, request(dhcp_message_type::DHCP_REQUEST, 1));
+        }
+        batcher.drain(EVENTS, CONFIG.ddns, secs, send);
+    }
+
+    ASSERT_EQ(500, srv.stats().acks);
+    ASSERT_EQ(0, EVENTS.dropped());
+    ASSERT_EQ(1, msgs);
+}
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+//
+// Configuration and client requests shared by the native tests.
+
+#ifndef FIXTURE_H
+#define FIXTURE_H
+
+#include <config.h>
+#include <dhcp.h>
+#include <utils.h>
+
+#include <cstring>
+
+constexpr pool_config TEST_POOL = {
+    ip4(10, 0, 0, 10),      // lease_start
+    ip4(255, 255, 255, 0),  // subnet
+    ip4(10, 0, 0, 1),       // gateway
+    ip4(10, 0, 0, 255),     // broadcast
+    ip4(192, 168, 2, 1),    // dns1
+    8 * 60 * 60,            // lease_time_secs
+    0,                      // lease_time_min_secs
+};
+
+constexpr server_config TEST_CONFIG = {
+    ip4(10, 0, 0, 2),  // local_ip
+    {TEST_POOL},       // pools
+    1,                 // npools
+    false,             // rapid_commit
+    {},                // ddns
+    "",                // ssid
+    "",                // wpa2
+};
+
+// Get TEST_CONFIG with the lease times of the local pool set to
+// 'lease_time_secs' and 'lease_time_min_secs'.
+constexpr server_config test_config(u32 lease_time_secs, u32 lease_time_min_secs = 0) {
+    server_config cfg = TEST_CONFIG;
+    cfg.pools[0].lease_time_secs = lease_time_secs;
+    cfg.pools[0].lease_time_min_secs = lease_time_min_secs;
+    return cfg;
+}
+
+// Build a client request of type 'type' for client 'id' into 'msg' and return
+// the message length. 'id' is used as hardware address and transaction id.
+//
+// The request asks for the subnet mask and router options and carries the
+// host name option if 'hostname' is not null. A DHCP_REQUEST carries the
+// server identifier 'server_id', it is omitted if 'server_id' is 0.
+inline usize make_request(dhcp_message& msg, dhcp_message_type type, u32 id, const char* hostname = nullptr,
+                          u32 server_id = TEST_CONFIG.local_ip) {
+    std::memset(&msg, 0, sizeof(msg));
+    msg.op = dhcp_operation::BOOTREQUEST;
+    msg.htype = 1;
+    msg.hlen = 6;
+    msg.xid = id;
+    put_opt_val(&msg.chaddr[2], id);
+    msg.cookie = DHCP_OPTION_COOKIE;
+
+    u8* optp = msg.options;
+    *optp++ = into_raw(dhcp_option::DHCP_MESSAGE_TYPE);
+    *optp++ = 1;
+    *optp++ = into_raw(type);
+
+    if (type == dhcp_message_type::DHCP_REQUEST && server_id != 0) {
+        *optp++ = into_raw(dhcp_option::SERVER_IDENTIFIER);
+        *optp++ = 4;
+        optp = put_opt_val(optp, server_id);
+    }
+
+    if (hostname) {
+        const usize len = std::strlen(hostname);
+        *optp++ = into_raw(dhcp_option::HOST_NAME);
+        *optp++ = len;
+        std::memcpy(optp, hostname, len);
+        optp += len;
+    }
+
+    *optp++ = into_raw(dhcp_option::PARAMETER_REQUEST_LIST);
+    *optp++ = 2;
+    *optp++ = into_raw(dhcp_option::SUBNET_MASK);
+    *optp++ = into_raw(dhcp_option::ROUTER);
+
+    *optp++ = into_raw(dhcp_option::END);
+    return optp - (u8*)&msg;
+}
+
+// Add the rapid commit option to the request 'msg' of length 'len'.
+inline usize rapid_commit(dhcp_message& msg, usize len) {
+    u8* optp = (u8*)&msg + len - 1 /* END */;
+    *optp++ = into_raw(dhcp_option::RAPID_COMMIT);
+    *optp++ = 0;
+    *optp++ = into_raw(dhcp_option::END);
+    return optp - (u8*)&msg;
+}
+
+// Build a DHCP_REQUEST of client 'id' renewing the address 'ciaddr'
+// (RENEWING state, no server identifier, rfc2131 4.3.2).
+inline usize make_renew(dhcp_message& msg, u32 id, u32 ciaddr) {
+    const usize len = make_request(msg, dhcp_message_type::DHCP_REQUEST, id, nullptr, 0 /* server_id */);
+    put_opt_val((u8*)&msg.ciaddr, ciaddr);
+    return len;
+}
+
+#endif
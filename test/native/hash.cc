@@ -2,9 +2,11 @@
 //
 // Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
 
+#include <lease_db.h>
 #include <types.h>
 #include <utils.h>
 
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <gtest/gtest.h>
@@ -53,12 +55,47 @@ TEST(hash, uniform_distribuation) {
     }
 }
 
-TEST(hash, DISABLED_collisions) {
+TEST(hash64, uniform_distribuation) {
+    constexpr usize BUCKETS = 64;
+    constexpr float BUCKET_SIZE = static_cast<float>(100) / BUCKETS;  // Bucket size in percent.
+    constexpr float BUCKET_ERR = BUCKET_SIZE * 0.05 /* 5% */;         // Allowed distribution error.
+
     const auto ids = read_blob();
 
-    std::unordered_map<u32, usize> hits;
+    // Check low and high bits.
+    usize cnt_lo[BUCKETS] = {0};
+    usize cnt_hi[BUCKETS] = {0};
     for (const auto& id : ids) {
-        u32 h = hash(id.data(), id.size());
+        u64 h = hash64(id.data(), id.size(), 0x5eed);
+        cnt_lo[h % BUCKETS] += 1;
+        cnt_hi[h >> 58] += 1;
+    }
+
+    for (usize b = 0; b < BUCKETS; ++b) {
+        for (const usize cnt : {cnt_lo[b], cnt_hi[b]}) {
+            const float dist = static_cast<float>(cnt) / ids.size() * 100;
+            ASSERT_GT(dist, BUCKET_SIZE - BUCKET_ERR);
+            ASSERT_LT(dist, BUCKET_SIZE + BUCKET_ERR);
+        }
+    }
+}
+
+TEST(hash64, keyed) {
+    const u8 id[] = {0xde, 0xad, 0xbe, 0xef, 0x00, 0x01};
+
+    ASSERT_EQ(hash64(id, sizeof(id), 1), hash64(id, sizeof(id), 1));
+    ASSERT_NE(hash64(id, sizeof(id), 1), hash64(id, sizeof(id), 2));
+
+    // Length is part of the hash (zero padded tail).
+    ASSERT_NE(hash64(id, 4, 1), hash64(id, 5, 1));
+}
+
+template<typename T, typename H>
+static usize count_collisions(const std::vector<ID>& ids, H&& hash_fn) {
+    std::unordered_map<T, usize> hits;
+    hits.reserve(ids.size());
+    for (const auto& id : ids) {
+        T h = hash_fn(id);
         hits[h] = hits[h] + 1;
     }
 
@@ -68,6 +105,55 @@ TEST(hash, DISABLED_collisions) {
             ++collisions;
         }
     }
+    return collisions;
+}
+
+TEST(hash, DISABLED_collisions) {
+    const auto ids = read_blob();
+
+    const usize c32 = count_collisions<u32>(ids, [](const ID& id) { return hash(id.data(), id.size()); });
+    const usize c64 = count_collisions<u64>(ids, [](const ID& id) { return hash64(id.data(), id.size(), 0x5eed); });
+    // Mixing quality of the 64 bit hash truncated to 32 bit, should be close
+    // to the birthday bound n^2 / 2^33.
+    const usize c64_32 = count_collisions<u32>(ids, [](const ID& id) { return u32(hash64(id.data(), id.size(), 0x5eed)); });
+
+    printf("Hashed %ld values got collisions: hash %ld, hash64 %ld, hash64 (truncated 32 bit) %ld, expected 32 bit %.0f\n", ids.size(),
+           c32, c64, c64_32, static_cast<double>(ids.size()) * ids.size() / 8589934592.0);
+}
+
+// Cost of a lease lookup, fingerprinting the client id and scanning the lease db.
+TEST(hash, DISABLED_lookup_cost) {
+    constexpr usize LEASES = 16;
+    constexpr usize ROUNDS = 1000000;
+
+    const auto ids = read_blob();
+
+    lease_db<LEASES> db32;
+    lease_db<LEASES> db64;
+    for (usize i = 0; i < LEASES; ++i) {
+        db32.new_lease(hash(ids[i].data(), ids[i].size()), 1);
+        db64.new_lease(hash64(ids[i].data(), ids[i].size(), 0x5eed), 1);
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    usize found = 0;
+    auto start = clock::now();
+    for (usize r = 0; r < ROUNDS; ++r) {
+        const auto& id = ids[r % (2 * LEASES)];  // half hits, half misses
+        found += db32.get_lease(hash(id.data(), id.size())).has_value();
+    }
+    const double ns32 = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ROUNDS;
+    ASSERT_EQ(ROUNDS / 2, found);
+
+    found = 0;
+    start = clock::now();
+    for (usize r = 0; r < ROUNDS; ++r) {
+        const auto& id = ids[r % (2 * LEASES)];
+        found += db64.get_lease(hash64(id.data(), id.size(), 0x5eed)).has_value();
+    }
+    const double ns64 = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ROUNDS;
+    ASSERT_EQ(ROUNDS / 2, found);
 
-    printf("Hashed %ld values got %ld collisions\n", ids.size(), collisions);
+    printf("Lookup with %ld leases: hash %.1f ns, hash64 %.1f ns\n", LEASES, ns32, ns64);
 }
@@ -85,3 +85,93 @@ TEST(lease_db, update_lease) {
     ASSERT_EQ(std::nullopt, db.get_lease(10));
     ASSERT_EQ(std::nullopt, db.get_lease(20));
 }
+
+TEST(lease_db, bind_lease) {
+    lease_db<2> db;
+
+    ASSERT_EQ(std::optional(0), db.new_lease(10, 100 /* lease end */));
+    ASSERT_EQ(false, db.entries()[0].bound);
+
+    ASSERT_EQ(std::optional(false), db.bind_lease(10, 200 /* lease end */));
+    ASSERT_EQ(true, db.entries()[0].bound);
+    ASSERT_EQ(200, db.lease_end(0));
+
+    ASSERT_EQ(std::optional(true), db.bind_lease(10, 300 /* lease end */));
+    ASSERT_EQ(300, db.lease_end(0));
+
+    ASSERT_EQ(std::nullopt, db.bind_lease(20, 300 /* lease end */));
+
+    // Freed leases start unbound again.
+    db.flush_expired(300 /* current time */);
+    ASSERT_EQ(std::optional(0), db.new_lease(20, 400 /* lease end */));
+    ASSERT_EQ(false, db.entries()[0].bound);
+}
+
+TEST(lease_db, flush_expired_callback) {
+    lease_db<3> db;
+
+    ASSERT_EQ(std::optional(0), db.new_lease(10, 100 /* lease end */));
+    ASSERT_EQ(std::optional(1), db.new_lease(20, 200 /* lease end */));
+    ASSERT_EQ(std::optional(false), db.bind_lease(10, 100 /* lease end */));
+
+    usize calls = 0;
+    db.flush_expired(150 /* current time */, [&](usize idx, const lease& l) {
+        ++calls;
+        ASSERT_EQ(0, idx);
+        ASSERT_EQ(10, l.client_hash);
+        ASSERT_EQ(true, l.bound);
+    });
+    ASSERT_EQ(1, calls);
+    ASSERT_EQ(1, db.active_leases());
+}
+
+TEST(lease_db, lease_end) {
+    lease_db<2> db;
+
+    ASSERT_EQ(std::optional(0), db.new_lease(10, 100 /* lease end */));
+    ASSERT_EQ(100, db.lease_end(0));
+    ASSERT_EQ(0, db.lease_end(1));
+    ASSERT_EQ(0, db.lease_end(2));  // out of range
+
+    ASSERT_EQ(true, db.update_lease(10, 300 /* lease end */));
+    ASSERT_EQ(300, db.lease_end(0));
+}
+
+TEST(lease_db, rebase) {
+    lease_db<4> db;
+
+    ASSERT_EQ(std::optional(0), db.new_lease(10, 100 /* lease end */));
+    ASSERT_EQ(std::optional(1), db.new_lease(20, 200 /* lease end */));
+    ASSERT_EQ(std::optional(2), db.new_lease(30, 300 /* lease end */));
+
+    // Range start moved up by one, first lease falls out of the range.
+    db.rebase(1);
+    ASSERT_EQ(2, db.active_leases());
+    ASSERT_EQ(std::nullopt, db.get_lease(10));
+    ASSERT_EQ(std::optional(0), db.get_lease(20));
+    ASSERT_EQ(std::optional(1), db.get_lease(30));
+    ASSERT_EQ(300, db.lease_end(1));
+
+    // Range start moved down by two.
+    db.rebase(-2);
+    ASSERT_EQ(2, db.active_leases());
+    ASSERT_EQ(std::optional(2), db.get_lease(20));
+    ASSERT_EQ(std::optional(3), db.get_lease(30));
+
+    // Range moved away.
+    db.rebase(100);
+    ASSERT_EQ(0, db.active_leases());
+}
+
+TEST(lease_db, swap_clear) {
+    lease_db<2> a;
+    lease_db<2> b;
+
+    ASSERT_EQ(std::optional(0), a.new_lease(10, 100 /* lease end */));
+    a.swap(b);
+    ASSERT_EQ(0, a.active_leases());
+    ASSERT_EQ(std::optional(0), b.get_lease(10));
+
+    b.clear();
+    ASSERT_EQ(0, b.active_leases());
+}
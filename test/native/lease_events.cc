@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include "fixture.h"
+
+#include <lease_events.h>
+#include <server.h>
+#include <utils.h>
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static constexpr server_config CONFIG = test_config(100 /* lease_time_secs */);
+
+static lease_event make_event(u32 addr) {
+    return {lease_event_type::NEW, 1, addr, 0, ""};
+}
+
+// Events raised by the server under test.
+static std::vector<lease_event> EVENTS;
+
+static void record_event(const lease_event& ev) {
+    EVENTS.push_back(ev);
+}
+
+TEST(event_ring, push_pop) {
+    event_ring<4> ring;
+
+    ASSERT_EQ(std::nullopt, ring.pop());
+
+    for (u32 a = 1; a <= 4; ++a) {
+        ASSERT_EQ(true, ring.push(make_event(a)));
+    }
+    // Full, new events are dropped.
+    ASSERT_EQ(false, ring.push(make_event(5)));
+    ASSERT_EQ(1, ring.dropped());
+
+    ASSERT_EQ(1, ring.pop()->addr);
+    ASSERT_EQ(true, ring.push(make_event(6)));
+
+    for (u32 a : {2, 3, 4, 6}) {
+        ASSERT_EQ(a, ring.pop()->addr);
+    }
+    ASSERT_EQ(std::nullopt, ring.pop());
+}
+
+TEST(event_ring, concurrent_consumer) {
+    auto ring = std::make_unique<event_ring<8>>();
+    constexpr u32 COUNT = 20000;
+
+    std::thread producer([&]() {
+        for (u32 a = 1; a <= COUNT; ++a) {
+            while (!ring->push(make_event(a))) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    // Events arrive complete and in order.
+    u32 next = 1;
+    while (next <= COUNT) {
+        if (const auto ev = ring->pop()) {
+            ASSERT_EQ(next, ev->addr);
+            ASSERT_EQ(1, ev->client_hash);
+            ++next;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+
+    ASSERT_EQ(std::nullopt, ring->pop());
+}
+
+TEST(lease_events, bind_renew_expire) {
+    EVENTS.clear();
+    dhcp_server<2> srv(CONFIG, nullptr, 1, record_event);
+    dhcp_message msg;
+
+    // Offers don't raise events.
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1, "laptop"), 0).has_value());
+    ASSERT_EQ(0, EVENTS.size());
+
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, 1, "laptop"), 10).has_value());
+    ASSERT_EQ(1, EVENTS.size());
+    ASSERT_EQ(lease_event_type::NEW, EVENTS[0].type);
+    ASSERT_EQ(ip4(10, 0, 0, 10), EVENTS[0].addr);
+    ASSERT_EQ(110, EVENTS[0].lease_end);
+    ASSERT_STREQ("laptop", EVENTS[0].hostname);
+    ASSERT_EQ(srv.leases().entries()[0].client_hash, EVENTS[0].client_hash);
+
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, 1), 60).has_value());
+    ASSERT_EQ(2, EVENTS.size());
+    ASSERT_EQ(lease_event_type::RENEW, EVENTS[1].type);
+    ASSERT_EQ(160, EVENTS[1].lease_end);
+    ASSERT_STREQ("", EVENTS[1].hostname);
+
+    srv.flush_expired(160);
+    ASSERT_EQ(3, EVENTS.size());
+    ASSERT_EQ(lease_event_type::EXPIRE, EVENTS[2].type);
+    ASSERT_EQ(ip4(10, 0, 0, 10), EVENTS[2].addr);
+    ASSERT_EQ(EVENTS[0].client_hash, EVENTS[2].client_hash);
+}
+
+TEST(lease_events, reconfigure_drop) {
+    EVENTS.clear();
+    dhcp_server<2> srv(CONFIG, nullptr, 1, record_event);
+    dhcp_message msg;
+
+    for (u8 mac : {1, 2}) {
+        ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, mac), 0).has_value());
+        ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, mac), 0).has_value());
+    }
+    ASSERT_EQ(2, EVENTS.size());
+
+    // Moving the range start drops the first lease.
+    server_config next = CONFIG;
+    next.pools[0].lease_start = ip4(10, 0, 0, 11);
+    ASSERT_EQ(true, srv.reconfigure(next));
+    ASSERT_EQ(3, EVENTS.size());
+    ASSERT_EQ(lease_event_type::EXPIRE, EVENTS[2].type);
+    ASSERT_EQ(ip4(10, 0, 0, 10), EVENTS[2].addr);
+    ASSERT_EQ(EVENTS[0].client_hash, EVENTS[2].client_hash);
+
+    // Changing the network drops all leases of the pool.
+    next.local_ip = ip4(10, 1, 0, 2);
+    next.pools[0].lease_start = ip4(10, 1, 0, 10);
+    next.pools[0].gateway = ip4(10, 1, 0, 1);
+    next.pools[0].broadcast = ip4(10, 1, 0, 255);
+    ASSERT_EQ(true, srv.reconfigure(next));
+    ASSERT_EQ(4, EVENTS.size());
+    ASSERT_EQ(lease_event_type::EXPIRE, EVENTS[3].type);
+    ASSERT_EQ(ip4(10, 0, 0, 11), EVENTS[3].addr);
+    ASSERT_EQ(EVENTS[1].client_hash, EVENTS[3].client_hash);
+    ASSERT_EQ(0, srv.leases().active_leases());
+}
+
+TEST(lease_events, offer_expire) {
+    EVENTS.clear();
+    dhcp_server<1> srv(CONFIG, nullptr, 1, record_event);
+    dhcp_message msg;
+
+    // Expired offers are freed without events, also when flushed inline on an
+    // exhausted pool.
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), 0).has_value());
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 2), 20).has_value());
+    srv.flush_expired(100);
+    ASSERT_EQ(0, EVENTS.size());
+}
+
+TEST(lease_events, hostname_truncated) {
+    EVENTS.clear();
+    server_config cfg = CONFIG;
+    cfg.rapid_commit = true;
+    dhcp_server<1> srv(cfg, nullptr, 1, record_event);
+    dhcp_message msg;
+
+    const usize len = rapid_commit(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1, "a-very-long-host-name-which-does-not-fit"));
+
+    // Rapid commit binds the lease on DHCP_DISCOVER.
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, len, 0).has_value());
+    ASSERT_EQ(1, EVENTS.size());
+    ASSERT_EQ(lease_event_type::NEW, EVENTS[0].type);
+    ASSERT_EQ(LEASE_EVENT_HOSTNAME_LEN, std::strlen(EVENTS[0].hostname));
+    ASSERT_EQ(0, std::strncmp("a-very-long-host-name-which-does", EVENTS[0].hostname, LEASE_EVENT_HOSTNAME_LEN));
+}
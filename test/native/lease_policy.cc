@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include "fixture.h"
+
+#include <lease_policy.h>
+#include <server.h>
+#include <utils.h>
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <vector>
+
+static constexpr server_config CONFIG = test_config(3600 /* lease_time_secs */, 60 /* lease_time_min_secs */);
+static constexpr pool_config POOL = CONFIG.pools[0];
+
+// Get the u32 option 'tag' from the reply 'msg' of length 'len'.
+static u32 reply_opt(const dhcp_message& msg, usize len, dhcp_option tag) {
+    const auto opt = get_option(msg.options, len - offsetof(dhcp_message, options), tag);
+    EXPECT_TRUE(opt.has_value());
+    return opt ? get_opt_val<u32>(opt->data) : 0;
+}
+
+TEST(lease_policy, adaptive_lease_time) {
+    // Idle pool grants the full lease time.
+    ASSERT_EQ(3600, adaptive_lease_time(POOL, 0, 16));
+    ASSERT_EQ(3600, adaptive_lease_time(POOL, 4, 16));
+
+    // Decays geometrically between the watermarks, sqrt(3600 * 60) halfway.
+    ASSERT_EQ(464, adaptive_lease_time(POOL, 500, 1000));
+    ASSERT_GT(adaptive_lease_time(POOL, 6, 16), adaptive_lease_time(POOL, 8, 16));
+    ASSERT_GT(adaptive_lease_time(POOL, 8, 16), adaptive_lease_time(POOL, 10, 16));
+
+    // Pool under pressure grants the minimal lease time.
+    ASSERT_EQ(60, adaptive_lease_time(POOL, 12, 16));
+    ASSERT_EQ(60, adaptive_lease_time(POOL, 16, 16));
+
+    // Disabled.
+    pool_config fixed = POOL;
+    fixed.lease_time_min_secs = 0;
+    ASSERT_EQ(3600, adaptive_lease_time(fixed, 16, 16));
+    fixed.lease_time_min_secs = 7200;
+    ASSERT_EQ(3600, adaptive_lease_time(fixed, 16, 16));
+}
+
+TEST(lease_policy, server_lease_times) {
+    dhcp_server<4> srv(CONFIG);
+    dhcp_message msg;
+
+    // Lease time granted to the n-th client joining the pool.
+    const u32 expect[] = {3600, 464, 60, 60};
+
+    for (u32 id = 0; id < 4; ++id) {
+        ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, id + 1), 0).has_value());
+        const auto reply = srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, id + 1), 0);
+        ASSERT_EQ(true, reply.has_value());
+
+        // T1 and T2 follow the granted lease time.
+        ASSERT_EQ(expect[id], reply_opt(msg, reply->len, dhcp_option::IP_ADDRESS_LEASE_TIME));
+        ASSERT_EQ(expect[id] / 2, reply_opt(msg, reply->len, dhcp_option::RENEWAL_TIME_T1));
+        ASSERT_EQ(expect[id] * 8 / 12, reply_opt(msg, reply->len, dhcp_option::REBINDING_TIME_T2));
+    }
+
+    // Short leases of the last clients expire first.
+    srv.flush_expired(61);
+    ASSERT_EQ(2, srv.leases().active_leases());
+}
+
+// Simulate a churning client population against a small pool for different
+// lease time policies, for a busy and a quiet network.
+//
+// Clients arrive at random, stay for a random time and leave without releasing
+// their lease. While present, clients renew their lease at T1 and retry to
+// join every step if the pool is exhausted.
+TEST(lease_policy, DISABLED_simulate_churn) {
+    constexpr usize CLIENTS = 48;
+    constexpr usize STEP_SECS = 60;
+    constexpr usize DURATION_SECS = 14 * 24 * 60 * 60;
+    constexpr double MEAN_STAY_SECS = 60 * 60;
+
+    const struct {
+        const char* name;
+        double mean_away_secs;
+    } traces[] = {
+        {"busy", 4 * 60 * 60},
+        {"quiet", 48 * 60 * 60},
+    };
+
+    const struct {
+        const char* name;
+        u32 lease_time_secs;
+        u32 lease_time_min_secs;
+    } policies[] = {
+        {"fixed 8h", 8 * 60 * 60, 0},
+        {"fixed 15min", 15 * 60, 0},
+        {"adaptive 8h..15min", 8 * 60 * 60, 15 * 60},
+    };
+
+    for (const auto& t : traces) {
+        for (const auto& p : policies) {
+            server_config cfg = CONFIG;
+            cfg.pools[0].lease_time_secs = p.lease_time_secs;
+            cfg.pools[0].lease_time_min_secs = p.lease_time_min_secs;
+            auto srv = std::make_unique<dhcp_server<16>>(cfg);
+            dhcp_message msg;
+
+            // Same trace for every policy.
+            std::mt19937 rng(42);
+            std::exponential_distribution<double> stay(1.0 / MEAN_STAY_SECS);
+            std::bernoulli_distribution arrive(STEP_SECS / t.mean_away_secs);
+
+            struct client {
+                bool present;
+                bool bound;
+                bool denied;
+                usize leave;
+                usize renew;
+                u32 addr;
+            };
+            std::vector<client> clients(CLIENTS, client{false, false, false, 0, 0, 0});
+
+            usize visits = 0, denied = 0, renewals = 0, msgs = 0, waiting_steps = 0;
+
+            // Run the DISCOVER/REQUEST exchange, return true if the client is bound.
+            const auto join = [&](client& c, u32 id, usize now) {
+                msgs += 2;
+                if (!srv->handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, id), now)) {
+                    return false;
+                }
+                msgs += 2;
+                const auto reply = srv->handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, id), now);
+                if (!reply) {
+                    return false;
+                }
+                c.renew = now + reply_opt(msg, reply->len, dhcp_option::RENEWAL_TIME_T1);
+                c.addr = get_opt_val<u32>((const u8*)&msg.yiaddr);
+                return true;
+            };
+
+            for (usize now = 0; now < DURATION_SECS; now += STEP_SECS) {
+                srv->flush_expired(now);
+
+                for (u32 id = 0; id < CLIENTS; ++id) {
+                    client& c = clients[id];
+
+                    if (c.present && now >= c.leave) {
+                        c = {false, false, false, 0, 0, 0};
+                    }
+
+                    if (!c.present) {
+                        if (!arrive(rng)) {
+                            continue;
+                        }
+                        c.present = true;
+                        c.leave = now + static_cast<usize>(stay(rng));
+                        ++visits;
+                    }
+
+                    if (!c.bound) {
+                        c.bound = join(c, id + 1, now);
+                        if (!c.bound) {
+                            ++waiting_steps;
+                            if (!c.denied) {
+                                c.denied = true;
+                                ++denied;
+                            }
+                        }
+                    } else if (now >= c.renew) {
+                        ++renewals;
+                        msgs += 2;
+                        const auto reply =
+                            srv->handle_dhcp_message(msg, make_renew(msg, id + 1, c.addr), now);
+                        if (reply) {
+                            c.renew = now + reply_opt(msg, reply->len, dhcp_option::RENEWAL_TIME_T1);
+                        } else {
+                            c.bound = false;
+                        }
+                    }
+                }
+            }
+
+            printf("%-5s %-18s: visits %zu denied %zu (%.1f%%) wait %.1f h renewals %zu msgs %zu\n", t.name, p.name, visits, denied,
+                   100.0 * denied / visits, waiting_steps * STEP_SECS / 3600.0, renewals, msgs);
+        }
+    }
+}
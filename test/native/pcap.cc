@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include <pcap.h>
+#include <utils.h>
+
+#include <gtest/gtest.h>
+#include <vector>
+
+static pcap_packet make_packet(u64 ts, const u8* payload, usize len) {
+    return {ts, ip4(0, 0, 0, 0), ip4(255, 255, 255, 255), DHCP_CLIENT_PORT, DHCP_SERVER_PORT, payload, len};
+}
+
+TEST(pcap, encode_decode_frame) {
+    const u8 payload[] = {1, 2, 3, 4};
+    u8 frame[PCAP_MAX_FRAME_LEN];
+
+    const auto len = pcap_encode_frame(frame, make_packet(0, payload, sizeof(payload)));
+    ASSERT_EQ(std::optional(PCAP_IPV4_HDR_LEN + PCAP_UDP_HDR_LEN + sizeof(payload)), len);
+
+    const auto pkt = pcap_decode_frame(frame, len.value(), PCAP_LINKTYPE_RAW);
+    ASSERT_EQ(true, pkt.has_value());
+    ASSERT_EQ(ip4(0, 0, 0, 0), pkt->src);
+    ASSERT_EQ(ip4(255, 255, 255, 255), pkt->dst);
+    ASSERT_EQ(DHCP_CLIENT_PORT, pkt->sport);
+    ASSERT_EQ(DHCP_SERVER_PORT, pkt->dport);
+    ASSERT_EQ(sizeof(payload), pkt->len);
+    ASSERT_EQ(0, std::memcmp(payload, pkt->payload, sizeof(payload)));
+
+    // Truncated frame.
+    ASSERT_EQ(false, pcap_decode_frame(frame, len.value() - 1, PCAP_LINKTYPE_RAW).has_value());
+}
+
+TEST(pcap, payload_too_large) {
+    static u8 payload[DHCP_MESSAGE_LEN + 1];
+    u8 frame[PCAP_MAX_FRAME_LEN];
+
+    ASSERT_EQ(std::nullopt, pcap_encode_frame(frame, make_packet(0, payload, sizeof(payload))));
+}
+
+TEST(pcap, ring_dump_read) {
+    pcap_ring<2> ring;
+
+    const u8 p1[] = {1};
+    const u8 p2[] = {2, 2};
+    const u8 p3[] = {3, 3, 3};
+    ring.push(make_packet(1000001, p1, sizeof(p1)));
+    ring.push(make_packet(2000002, p2, sizeof(p2)));
+    ring.push(make_packet(3000003, p3, sizeof(p3)));  // overwrites p1
+    ASSERT_EQ(2, ring.size());
+
+    std::vector<u8> file;
+    ring.dump([&](const u8* data, usize len) { file.insert(file.end(), data, data + len); });
+
+    pcap_reader rd(file.data(), file.size());
+    ASSERT_EQ(true, rd.init());
+
+    auto pkt = rd.next();
+    ASSERT_EQ(true, pkt.has_value());
+    ASSERT_EQ(2000002, pkt->ts_usec);
+    ASSERT_EQ(sizeof(p2), pkt->len);
+
+    pkt = rd.next();
+    ASSERT_EQ(true, pkt.has_value());
+    ASSERT_EQ(3000003, pkt->ts_usec);
+    ASSERT_EQ(sizeof(p3), pkt->len);
+
+    ASSERT_EQ(false, rd.next().has_value());
+}
+
+TEST(pcap, write_record_read) {
+    const u8 payload[] = {0xaa, 0xbb};
+
+    std::vector<u8> file;
+    auto write = [&](const u8* data, usize len) { file.insert(file.end(), data, data + len); };
+
+    const pcap_file_header fhdr = pcap_header();
+    write((const u8*)&fhdr, sizeof(fhdr));
+    ASSERT_EQ(true, pcap_write_record(write, make_packet(42, payload, sizeof(payload))));
+
+    pcap_reader rd(file.data(), file.size());
+    ASSERT_EQ(true, rd.init());
+    const auto pkt = rd.next();
+    ASSERT_EQ(true, pkt.has_value());
+    ASSERT_EQ(42, pkt->ts_usec);
+    ASSERT_EQ(0xaa, pkt->payload[0]);
+    ASSERT_EQ(0xbb, pkt->payload[1]);
+}
+
+TEST(pcap, reader_bad_magic) {
+    const u8 file[sizeof(pcap_file_header)] = {0};
+
+    pcap_reader rd(file, sizeof(file));
+    ASSERT_EQ(false, rd.init());
+}
+
+TEST(pcap, relay_capture) {
+    dhcp_message req;
+    std::memset(&req, 0, sizeof(req));
+    req.op = dhcp_operation::BOOTREQUEST;
+    put_opt_val((u8*)&req.giaddr, ip4(10, 1, 0, 1));
+
+    dhcp_message ack = req;
+    ack.op = dhcp_operation::BOOTREPLY;
+
+    // Relay agent and server send from and to the server port.
+    const u8* reqp = (const u8*)&req;
+    const u8* ackp = (const u8*)&ack;
+    const pcap_packet relayed_req = {1, ip4(10, 1, 0, 1), ip4(10, 0, 0, 2), DHCP_SERVER_PORT, DHCP_SERVER_PORT, reqp, DHCP_MESSAGE_MIN_LEN};
+    const pcap_packet relayed_ack = {2, ip4(10, 0, 0, 2), ip4(10, 1, 0, 1), DHCP_SERVER_PORT, DHCP_SERVER_PORT, ackp, DHCP_MESSAGE_MIN_LEN};
+
+    std::vector<u8> file;
+    auto write = [&](const u8* data, usize len) { file.insert(file.end(), data, data + len); };
+
+    const pcap_file_header fhdr = pcap_header();
+    write((const u8*)&fhdr, sizeof(fhdr));
+    ASSERT_EQ(true, pcap_write_record(write, relayed_req));
+    ASSERT_EQ(true, pcap_write_record(write, relayed_ack));
+
+    pcap_reader rd(file.data(), file.size());
+    ASSERT_EQ(true, rd.init());
+
+    auto pkt = rd.next();
+    ASSERT_EQ(true, pkt.has_value());
+    ASSERT_EQ(std::optional(dhcp_operation::BOOTREQUEST), pcap_dhcp_op(pkt.value()));
+
+    pkt = rd.next();
+    ASSERT_EQ(true, pkt.has_value());
+    ASSERT_EQ(std::optional(dhcp_operation::BOOTREPLY), pcap_dhcp_op(pkt.value()));
+
+    // Direct client request and non dhcp payload.
+    const u8 payload[] = {1, 2, 3, 4};
+    ASSERT_EQ(std::optional(dhcp_operation::BOOTREQUEST),
+              pcap_dhcp_op({0, ip4(0, 0, 0, 0), ip4(255, 255, 255, 255), DHCP_CLIENT_PORT, DHCP_SERVER_PORT, reqp, DHCP_MESSAGE_MIN_LEN}));
+    ASSERT_EQ(std::nullopt, pcap_dhcp_op(make_packet(0, payload, sizeof(payload))));
+}
@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include <pool_index.h>
+#include <utils.h>
+
+#include <chrono>
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+TEST(pool_index, find) {
+    // Deliberately unsorted.
+    const pool_range ranges[] = {
+        {ip4(10, 2, 0, 0), ip4(10, 2, 0, 255)},
+        {ip4(10, 0, 0, 0), ip4(10, 0, 0, 255)},
+        {ip4(10, 1, 0, 0), ip4(10, 1, 255, 255)},
+    };
+
+    pool_index<4> idx;
+    ASSERT_EQ(true, idx.build(ranges, 3));
+    ASSERT_EQ(3, idx.size());
+
+    ASSERT_EQ(std::optional(1), idx.find(ip4(10, 0, 0, 0)));
+    ASSERT_EQ(std::optional(1), idx.find(ip4(10, 0, 0, 255)));
+    ASSERT_EQ(std::optional(2), idx.find(ip4(10, 1, 42, 1)));
+    ASSERT_EQ(std::optional(0), idx.find(ip4(10, 2, 0, 1)));
+
+    ASSERT_EQ(std::nullopt, idx.find(ip4(9, 255, 255, 255)));
+    ASSERT_EQ(std::nullopt, idx.find(ip4(10, 2, 1, 0)));
+    ASSERT_EQ(std::nullopt, idx.find(ip4(255, 255, 255, 255)));
+}
+
+TEST(pool_index, empty) {
+    pool_index<1> idx;
+
+    ASSERT_EQ(true, idx.build(nullptr, 0));
+    ASSERT_EQ(std::nullopt, idx.find(ip4(10, 0, 0, 1)));
+}
+
+TEST(pool_index, invalid) {
+    const pool_range overlap[] = {
+        {ip4(10, 0, 0, 0), ip4(10, 0, 0, 255)},
+        {ip4(10, 0, 0, 128), ip4(10, 0, 1, 255)},
+    };
+    const pool_range malformed[] = {
+        {ip4(10, 0, 0, 255), ip4(10, 0, 0, 0)},
+    };
+
+    pool_index<2> idx;
+    ASSERT_EQ(false, idx.build(overlap, 2));
+    ASSERT_EQ(0, idx.size());
+    ASSERT_EQ(false, idx.build(malformed, 1));
+    ASSERT_EQ(false, idx.build(overlap, 3));  // too many
+}
+
+// Compare the binary search of the index against a linear scan over the pools.
+TEST(pool_index, DISABLED_benchmark) {
+    constexpr usize POOLS = 512;
+    constexpr usize LOOKUPS = 1000000;
+
+    // One /24 pool per relay network in 10.x.y.0.
+    std::vector<pool_range> ranges;
+    for (usize p = 0; p < POOLS; ++p) {
+        const u32 net = ip4(10, p >> 8, p & 0xff, 0);
+        ranges.push_back({net, net | 0xff});
+    }
+    std::shuffle(ranges.begin(), ranges.end(), std::mt19937(42));
+
+    static pool_index<POOLS> idx;
+    ASSERT_EQ(true, idx.build(ranges.data(), ranges.size()));
+
+    std::vector<u32> addrs;
+    std::mt19937 rng(1);
+    for (usize i = 0; i < LOOKUPS; ++i) {
+        addrs.push_back(ip4(10, 0, 0, 0) + (rng() % (POOLS * 256)));
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    usize hits = 0;
+    auto start = clock::now();
+    for (u32 addr : addrs) {
+        hits += idx.find(addr).has_value();
+    }
+    const double index_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / LOOKUPS;
+    ASSERT_EQ(LOOKUPS, hits);
+
+    hits = 0;
+    start = clock::now();
+    for (u32 addr : addrs) {
+        for (usize p = 0; p < ranges.size(); ++p) {
+            if (addr >= ranges[p].first && addr <= ranges[p].last) {
+                ++hits;
+                break;
+            }
+        }
+    }
+    const double linear_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / LOOKUPS;
+    ASSERT_EQ(LOOKUPS, hits);
+
+    printf("%zu pools: index %.1f ns/lookup, linear scan %.1f ns/lookup\n", POOLS, index_ns, linear_ns);
+}
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include "fixture.h"
+
+#include <query.h>
+#include <seqlock.h>
+#include <server.h>
+#include <utils.h>
+
+#include <atomic>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+
+TEST(seqlock, write_read) {
+    seqlock<int> lock;
+    int val = -1;
+
+    ASSERT_EQ(0, lock.read(val));
+    ASSERT_EQ(0, val);
+
+    lock.write([](int& v) { v = 1; });
+    ASSERT_EQ(1, lock.read(val));
+    ASSERT_EQ(1, val);
+
+    lock.write([](int& v) { v += 1; });
+    ASSERT_EQ(2, lock.read(val));
+    ASSERT_EQ(2, val);
+}
+
+TEST(seqlock, concurrent_reader) {
+    struct data {
+        u64 vals[64];
+    };
+    auto lock = std::make_unique<seqlock<data>>();
+
+    std::atomic<bool> done{false};
+    std::thread writer([&]() {
+        for (u64 n = 1; n <= 20000; ++n) {
+            lock->write([&](data& d) {
+                for (u64& v : d.vals) {
+                    v = n;
+                }
+            });
+        }
+        done.store(true);
+    });
+
+    // Readers never observe a partially written value.
+    data d;
+    usize reads = 0;
+    while (!done.load() || reads == 0) {
+        lock->read(d);
+        for (const u64 v : d.vals) {
+            ASSERT_EQ(d.vals[0], v);
+        }
+        ++reads;
+    }
+    writer.join();
+
+    lock->read(d);
+    ASSERT_EQ(20000, d.vals[0]);
+}
+
+TEST(query, snapshot) {
+    dhcp_server<4> srv(TEST_CONFIG, nullptr, 1);
+    dhcp_message msg;
+
+    for (u8 mac = 1; mac <= 2; ++mac) {
+        ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, mac), 0).has_value());
+        ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, mac), 10).has_value());
+    }
+    // Unknown client.
+    ASSERT_EQ(false, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, 3), 10).has_value());
+
+    seqlock<server_snapshot<4>> lock;
+    lock.write([&](server_snapshot<4>& snap) { srv.snapshot(snap, 20); });
+
+    server_snapshot<4> snap;
+    ASSERT_EQ(1, lock.read(snap));
+
+    ASSERT_EQ(20, snap.now_secs);
+    ASSERT_EQ(5, snap.stats.received);
+    ASSERT_EQ(2, snap.stats.discovers);
+    ASSERT_EQ(3, snap.stats.requests);
+    ASSERT_EQ(2, snap.stats.offers);
+    ASSERT_EQ(2, snap.stats.acks);
+    ASSERT_EQ(0, snap.stats.exhausted);
+
+    ASSERT_EQ(1, snap.npools);
+    ASSERT_EQ(TEST_POOL.lease_start, snap.pools[0].lease_start);
+    ASSERT_EQ(2, snap.pools[0].active);
+    ASSERT_EQ(10 + TEST_POOL.lease_time_secs, snap.pools[0].leases[0].lease_end);
+    ASSERT_EQ(0, snap.pools[0].leases[2].client_hash);
+
+    // Later changes don't show up in the published snapshot.
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 3), 30).has_value());
+    lock.read(snap);
+    ASSERT_EQ(2, snap.pools[0].active);
+
+    std::string text;
+    format_snapshot(snap, [&](const char* str, usize len) { text.append(str, len); });
+
+    ASSERT_EQ(0, text.find("time 20\n"
+                           "stats received 5 discovers 2 requests 3 offers 2 acks 2 exhausted 0\n"
+                           "pool 0 start 10.0.0.10 active 2/4\n"
+                           "lease 10.0.0.10 client "));
+    ASSERT_NE(std::string::npos, text.find("lease 10.0.0.11 client "));
+    ASSERT_NE(std::string::npos, text.find(" expires 28810\n"));
+    ASSERT_EQ(std::string::npos, text.find("10.0.0.12"));
+}
+
+TEST(query, exhausted) {
+    dhcp_server<1> srv(TEST_CONFIG);
+    dhcp_message msg;
+
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), 0).has_value());
+    ASSERT_EQ(false, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 2), 0).has_value());
+
+    ASSERT_EQ(2, srv.stats().discovers);
+    ASSERT_EQ(1, srv.stats().exhausted);
+}
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include <scheduler.h>
+
+#include <gtest/gtest.h>
+
+// Simulated clock, each task step takes 'STEP_US'.
+static u64 NOW_US = 0;
+static constexpr u64 STEP_US = 10;
+
+static usize RUNS_A = 0;
+static usize RUNS_B = 0;
+static usize MORE_B = 0;
+
+static bool task_a(u64) {
+    ++RUNS_A;
+    NOW_US += STEP_US;
+    return false;
+}
+
+static bool task_b(u64) {
+    ++RUNS_B;
+    NOW_US += STEP_US;
+    return MORE_B > 0 && --MORE_B > 0;
+}
+
+static void reset() {
+    NOW_US = 0;
+    RUNS_A = RUNS_B = MORE_B = 0;
+}
+
+static u64 now_us() {
+    return NOW_US;
+}
+
+TEST(scheduler, add_exhausted) {
+    scheduler<1> sched;
+
+    ASSERT_EQ(true, sched.add(task_a, 100));
+    ASSERT_EQ(false, sched.add(task_b, 100));
+}
+
+TEST(scheduler, periodic) {
+    reset();
+    scheduler<2> sched;
+    sched.add(task_a, 100);
+    sched.add(task_b, 200);
+
+    // Both tasks are due initially.
+    ASSERT_EQ(2, sched.run(now_us, [] { return false; }, 1000));
+    ASSERT_EQ(1, RUNS_A);
+    ASSERT_EQ(1, RUNS_B);
+
+    // Nothing due yet.
+    ASSERT_EQ(0, sched.run(now_us, [] { return false; }, 1000));
+
+    NOW_US = 110;
+    ASSERT_EQ(1, sched.run(now_us, [] { return false; }, 1000));
+    ASSERT_EQ(2, RUNS_A);
+    ASSERT_EQ(1, RUNS_B);
+
+    NOW_US = 220;
+    ASSERT_EQ(2, sched.run(now_us, [] { return false; }, 1000));
+    ASSERT_EQ(3, RUNS_A);
+    ASSERT_EQ(2, RUNS_B);
+}
+
+TEST(scheduler, budget) {
+    reset();
+    scheduler<2> sched;
+    sched.add(task_b, 1000);
+
+    // Task has more work than the budget allows (STEP_US per step).
+    MORE_B = 100;
+    ASSERT_EQ(5, sched.run(now_us, [] { return false; }, 5 * STEP_US));
+    ASSERT_EQ(5, RUNS_B);
+
+    // Remaining work continues in the next run.
+    ASSERT_EQ(95, sched.run(now_us, [] { return false; }, 1000 * STEP_US));
+    ASSERT_EQ(100, RUNS_B);
+}
+
+TEST(scheduler, preempt) {
+    reset();
+    scheduler<2> sched;
+    sched.add(task_a, 100);
+    sched.add(task_b, 100);
+
+    ASSERT_EQ(0, sched.run(now_us, [] { return true; }, 1000));
+    ASSERT_EQ(0, RUNS_A);
+    ASSERT_EQ(0, RUNS_B);
+
+    // Preempt after the first step.
+    usize checks = 0;
+    ASSERT_EQ(1, sched.run(now_us, [&] { return checks++ > 0; }, 1000));
+    ASSERT_EQ(1, RUNS_A + RUNS_B);
+}
+
+TEST(scheduler, round_robin) {
+    reset();
+    scheduler<2> sched;
+    sched.add(task_a, 0);
+    sched.add(task_b, 0);
+
+    // Both tasks always due, must alternate.
+    ASSERT_EQ(10, sched.run(now_us, [] { return false; }, 10 * STEP_US));
+    ASSERT_EQ(5, RUNS_A);
+    ASSERT_EQ(5, RUNS_B);
+}
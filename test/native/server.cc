@@ -0,0 +1,383 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include "fixture.h"
+
+#include <server.h>
+#include <utils.h>
+
+#include <chrono>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+
+static dhcp_message_type reply_type(const dhcp_message& msg, usize len) {
+    const auto opt = get_option(msg.options, len - offsetof(dhcp_message, options), dhcp_option::DHCP_MESSAGE_TYPE);
+    EXPECT_TRUE(opt.has_value());
+    return from_raw<dhcp_message_type>(opt->data[0]);
+}
+
+TEST(server, discover_request) {
+    dhcp_server<2> srv(TEST_CONFIG);
+    dhcp_message msg;
+
+    {
+        const auto reply = srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), 0);
+        ASSERT_EQ(true, reply.has_value());
+        ASSERT_EQ(TEST_POOL.broadcast, reply->dst);
+        ASSERT_EQ(DHCP_CLIENT_PORT, reply->port);
+        ASSERT_EQ(dhcp_operation::BOOTREPLY, msg.op);
+        ASSERT_EQ(dhcp_message_type::DHCP_OFFER, reply_type(msg, reply->len));
+        ASSERT_EQ(ip4(10, 0, 0, 10), get_opt_val<u32>((const u8*)&msg.yiaddr));
+        ASSERT_EQ(TEST_CONFIG.local_ip, get_opt_val<u32>((const u8*)&msg.siaddr));
+    }
+    {
+        const auto reply = srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, 1), 1);
+        ASSERT_EQ(true, reply.has_value());
+        ASSERT_EQ(dhcp_message_type::DHCP_ACK, reply_type(msg, reply->len));
+        ASSERT_EQ(ip4(10, 0, 0, 10), get_opt_val<u32>((const u8*)&msg.yiaddr));
+
+        const usize opt_len = reply->len - offsetof(dhcp_message, options);
+        const auto router = get_option(msg.options, opt_len, dhcp_option::ROUTER);
+        ASSERT_EQ(true, router.has_value());
+        ASSERT_EQ(TEST_POOL.gateway, get_opt_val<u32>(router->data));
+        const auto lease_time = get_option(msg.options, opt_len, dhcp_option::IP_ADDRESS_LEASE_TIME);
+        ASSERT_EQ(true, lease_time.has_value());
+        ASSERT_EQ(TEST_POOL.lease_time_secs, get_opt_val<u32>(lease_time->data));
+    }
+
+    ASSERT_EQ(1, srv.leases().active_leases());
+}
+
+TEST(server, request_other_server) {
+    dhcp_server<2> srv(TEST_CONFIG);
+    dhcp_message msg;
+
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), 0).has_value());
+    const usize len = make_request(msg, dhcp_message_type::DHCP_REQUEST, 1, nullptr, ip4(10, 0, 0, 3));
+    ASSERT_EQ(false, srv.handle_dhcp_message(msg, len, 0).has_value());
+}
+
+TEST(server, request_renewing) {
+    dhcp_server<2> srv(TEST_CONFIG);
+    dhcp_message msg;
+
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), 0).has_value());
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, 1), 0).has_value());
+
+    // RENEWING client sends its address without server identifier, the ack
+    // is sent unicast to the client address.
+    const auto reply = srv.handle_dhcp_message(msg, make_renew(msg, 1, ip4(10, 0, 0, 10)), 50);
+    ASSERT_EQ(true, reply.has_value());
+    ASSERT_EQ(dhcp_message_type::DHCP_ACK, reply_type(msg, reply->len));
+    ASSERT_EQ(ip4(10, 0, 0, 10), reply->dst);
+    ASSERT_EQ(DHCP_CLIENT_PORT, reply->port);
+    ASSERT_EQ(ip4(10, 0, 0, 10), get_opt_val<u32>((const u8*)&msg.ciaddr));
+    ASSERT_EQ(ip4(10, 0, 0, 10), get_opt_val<u32>((const u8*)&msg.yiaddr));
+    ASSERT_EQ(50 + TEST_POOL.lease_time_secs, srv.leases().lease_end(0));
+
+    // Renewing an address not owned by the client.
+    ASSERT_EQ(false, srv.handle_dhcp_message(msg, make_renew(msg, 1, ip4(10, 0, 0, 11)), 60).has_value());
+
+    // INIT-REBOOT, neither server identifier nor client address.
+    const usize len = make_request(msg, dhcp_message_type::DHCP_REQUEST, 1, nullptr, 0 /* server_id */);
+    ASSERT_EQ(false, srv.handle_dhcp_message(msg, len, 60).has_value());
+}
+
+TEST(server, offer_expires) {
+    dhcp_server<1> srv(TEST_CONFIG);
+    dhcp_message msg;
+
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), 0).has_value());
+    // exhausted
+    ASSERT_EQ(false, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 2), 0).has_value());
+    // offer to first client expired
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 2), 100).has_value());
+}
+
+TEST(server, malformed) {
+    dhcp_server<2> srv(TEST_CONFIG);
+    dhcp_message msg;
+
+    const usize len = make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1);
+    ASSERT_EQ(false, srv.handle_dhcp_message(msg, DHCP_MESSAGE_MIN_LEN - 1, 0).has_value());
+
+    msg.cookie = 0;
+    ASSERT_EQ(false, srv.handle_dhcp_message(msg, len, 0).has_value());
+}
+
+TEST(server, rediscover_expired_lease) {
+    dhcp_server<1> srv(TEST_CONFIG);
+    dhcp_message msg;
+
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), 0).has_value());
+
+    // Lease expired but not flushed, the offer must be reserved again.
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), 100).has_value());
+    srv.flush_expired(110);
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, 1), 110).has_value());
+    ASSERT_EQ(1, srv.leases().active_leases());
+}
+
+TEST(server, reconfigure_migrates_leases) {
+    dhcp_server<4> srv(TEST_CONFIG);
+    dhcp_message msg;
+
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), 0).has_value());
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 2), 0).has_value());
+    ASSERT_EQ(ip4(10, 0, 0, 11), get_opt_val<u32>((const u8*)&msg.yiaddr));
+
+    // Move range start such that the first client falls out of the range.
+    server_config next = TEST_CONFIG;
+    next.pools[0].lease_start = ip4(10, 0, 0, 11);
+    next.pools[0].lease_time_secs = 60;
+    ASSERT_EQ(true, srv.reconfigure(next));
+    ASSERT_EQ(ip4(10, 0, 0, 11), srv.config().pools[0].lease_start);
+    ASSERT_EQ(1, srv.leases().active_leases());
+
+    // Second client keeps its address and gets the new lease time.
+    const auto reply = srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, 2), 1);
+    ASSERT_EQ(true, reply.has_value());
+    ASSERT_EQ(ip4(10, 0, 0, 11), get_opt_val<u32>((const u8*)&msg.yiaddr));
+    const auto lease_time = get_option(msg.options, reply->len - offsetof(dhcp_message, options), dhcp_option::IP_ADDRESS_LEASE_TIME);
+    ASSERT_EQ(60, get_opt_val<u32>(lease_time->data));
+}
+
+TEST(server, reconfigure_invalid_range) {
+    dhcp_server<16> srv(TEST_CONFIG);
+
+    // Range of 16 leases from 10.0.0.250 includes the broadcast address.
+    server_config next = TEST_CONFIG;
+    next.pools[0].lease_start = ip4(10, 0, 0, 250);
+    ASSERT_EQ(false, srv.reconfigure(next));
+    ASSERT_EQ(TEST_CONFIG.pools[0].lease_start, srv.config().pools[0].lease_start);
+
+    next.pools[0].lease_start = ip4(10, 0, 0, 239);
+    ASSERT_EQ(true, srv.reconfigure(next));
+}
+
+// Relay pool served through relay agent 10.<n>.0.1.
+static pool_config relay_pool(u8 n) {
+    pool_config pool = TEST_POOL;
+    pool.lease_start = ip4(10, n, 0, 10);
+    pool.gateway = ip4(10, n, 0, 1);
+    pool.broadcast = ip4(10, n, 0, 255);
+    return pool;
+}
+
+static usize relay(dhcp_message& msg, usize len, u32 giaddr) {
+    put_opt_val((u8*)&msg.giaddr, giaddr);
+    return len;
+}
+
+TEST(server, relay_pools) {
+    server_config cfg = TEST_CONFIG;
+    cfg.pools[1] = relay_pool(1);
+    cfg.pools[2] = relay_pool(2);
+    cfg.npools = 3;
+
+    dhcp_server<2> srv(cfg);
+    dhcp_message msg;
+
+    {
+        const auto reply =
+            srv.handle_dhcp_message(msg, relay(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), ip4(10, 2, 0, 1)), 0);
+        ASSERT_EQ(true, reply.has_value());
+        ASSERT_EQ(ip4(10, 2, 0, 1), reply->dst);
+        ASSERT_EQ(DHCP_SERVER_PORT, reply->port);
+        ASSERT_EQ(ip4(10, 2, 0, 10), get_opt_val<u32>((const u8*)&msg.yiaddr));
+        ASSERT_EQ(ip4(10, 2, 0, 1), get_opt_val<u32>((const u8*)&msg.giaddr));
+
+        const auto router = get_option(msg.options, reply->len - offsetof(dhcp_message, options), dhcp_option::ROUTER);
+        ASSERT_EQ(ip4(10, 2, 0, 1), get_opt_val<u32>(router->data));
+    }
+    {
+        // Same client on the local network gets a lease from the local pool.
+        const auto reply = srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), 0);
+        ASSERT_EQ(true, reply.has_value());
+        ASSERT_EQ(TEST_POOL.broadcast, reply->dst);
+        ASSERT_EQ(DHCP_CLIENT_PORT, reply->port);
+        ASSERT_EQ(ip4(10, 0, 0, 10), get_opt_val<u32>((const u8*)&msg.yiaddr));
+    }
+
+    // Relay agent without pool.
+    ASSERT_EQ(false, srv.handle_dhcp_message(msg, relay(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), ip4(10, 3, 0, 1)), 0)
+                         .has_value());
+
+    ASSERT_EQ(1, srv.leases(0).active_leases());
+    ASSERT_EQ(0, srv.leases(1).active_leases());
+    ASSERT_EQ(1, srv.leases(2).active_leases());
+}
+
+TEST(server, relay_pool_renewing) {
+    server_config cfg = TEST_CONFIG;
+    cfg.pools[1] = relay_pool(1);
+    cfg.npools = 2;
+
+    dhcp_server<2> srv(cfg);
+    dhcp_message msg;
+
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, relay(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), ip4(10, 1, 0, 1)), 0)
+                        .has_value());
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, relay(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, 1), ip4(10, 1, 0, 1)), 0)
+                        .has_value());
+
+    // Renewals are sent directly to the server without relay agent, the pool
+    // is selected by the client address.
+    const auto reply = srv.handle_dhcp_message(msg, make_renew(msg, 1, ip4(10, 1, 0, 10)), 10);
+    ASSERT_EQ(true, reply.has_value());
+    ASSERT_EQ(ip4(10, 1, 0, 10), reply->dst);
+    ASSERT_EQ(DHCP_CLIENT_PORT, reply->port);
+    ASSERT_EQ(10 + TEST_POOL.lease_time_secs, srv.leases(1).lease_end(0));
+}
+
+TEST(server, reconfigure_migrates_pools) {
+    server_config cfg = TEST_CONFIG;
+    cfg.pools[1] = relay_pool(1);
+    cfg.pools[2] = relay_pool(2);
+    cfg.npools = 3;
+
+    dhcp_server<2> srv(cfg);
+    dhcp_message msg;
+
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, relay(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1), ip4(10, 1, 0, 1)), 0)
+                        .has_value());
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, relay(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 2), ip4(10, 2, 0, 1)), 0)
+                        .has_value());
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, relay(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 3), ip4(10, 2, 0, 1)), 0)
+                        .has_value());
+
+    // Swap pool order, drop pool 1 and add pool 3.
+    cfg.pools[1] = relay_pool(3);
+    cfg.pools[2] = relay_pool(2);
+    ASSERT_EQ(true, srv.reconfigure(cfg));
+
+    ASSERT_EQ(0, srv.leases(1).active_leases());
+    ASSERT_EQ(2, srv.leases(2).active_leases());
+
+    // Client keeps its address in pool 2.
+    const auto reply = srv.handle_dhcp_message(
+        msg, relay(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, 3), ip4(10, 2, 0, 1)), 1);
+    ASSERT_EQ(true, reply.has_value());
+    ASSERT_EQ(ip4(10, 2, 0, 11), get_opt_val<u32>((const u8*)&msg.yiaddr));
+
+    // Overlapping pools are rejected.
+    cfg.pools[1] = relay_pool(2);
+    ASSERT_EQ(false, srv.reconfigure(cfg));
+}
+
+// Serve clients through relay agents for all pools.
+TEST(server, DISABLED_benchmark_pools) {
+    constexpr usize ROUNDS = 100;
+
+    server_config cfg = TEST_CONFIG;
+    cfg.npools = CONFIG_MAX_POOLS;
+    for (usize p = 1; p < cfg.npools; ++p) {
+        cfg.pools[p] = relay_pool(p);
+    }
+
+    auto srv = std::make_unique<dhcp_server<16>>(cfg);
+    dhcp_message msg;
+
+    usize replies = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (usize r = 0; r < ROUNDS; ++r) {
+        for (usize p = 1; p < cfg.npools; ++p) {
+            const auto type = r % 2 ? dhcp_message_type::DHCP_REQUEST : dhcp_message_type::DHCP_DISCOVER;
+            replies += srv->handle_dhcp_message(msg, relay(msg, make_request(msg, type, r / 2 % 16), ip4(10, p, 0, 1)), 0).has_value();
+        }
+    }
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const usize msgs = ROUNDS * (cfg.npools - 1);
+    ASSERT_EQ(msgs, replies);
+    printf("%zu pools: %.0f ns/msg (%.0f msg/s)\n", cfg.npools, secs * 1e9 / msgs, msgs / secs);
+}
+
+TEST(server, hash_collision_distinct_leases) {
+    // Hardware addresses whose 32 bit 'hash()' collides.
+    const u8 mac_a[] = {0x1c, 0x6d, 0xcd, 0x60, 0x0e, 0x89};
+    const u8 mac_b[] = {0x9c, 0xed, 0xc1, 0x12, 0x02, 0xe4};
+    ASSERT_EQ(hash(mac_a, sizeof(mac_a)), hash(mac_b, sizeof(mac_b)));
+
+    dhcp_server<2> srv(TEST_CONFIG, nullptr, 0x0123456789abcdef);
+    dhcp_message msg;
+
+    usize len = make_request(msg, dhcp_message_type::DHCP_DISCOVER, 0);
+    std::memcpy(msg.chaddr, mac_a, sizeof(mac_a));
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, len, 0).has_value());
+    ASSERT_EQ(ip4(10, 0, 0, 10), get_opt_val<u32>((const u8*)&msg.yiaddr));
+
+    len = make_request(msg, dhcp_message_type::DHCP_DISCOVER, 0);
+    std::memcpy(msg.chaddr, mac_b, sizeof(mac_b));
+    ASSERT_EQ(true, srv.handle_dhcp_message(msg, len, 0).has_value());
+    ASSERT_EQ(ip4(10, 0, 0, 11), get_opt_val<u32>((const u8*)&msg.yiaddr));
+
+    ASSERT_EQ(2, srv.leases().active_leases());
+}
+
+// Run the client side of a join, return the number of messages exchanged
+// until the client got its DHCP_ACK.
+static usize join(dhcp_server<2>& srv, dhcp_message& msg, u8 mac) {
+    usize msgs = 0;
+    auto reply = srv.handle_dhcp_message(msg, rapid_commit(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, mac)), 0);
+    msgs += 2;
+    EXPECT_TRUE(reply.has_value());
+
+    if (reply_type(msg, reply->len) == dhcp_message_type::DHCP_OFFER) {
+        reply = srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_REQUEST, mac), 0);
+        msgs += 2;
+        EXPECT_TRUE(reply.has_value());
+    }
+
+    EXPECT_EQ(dhcp_message_type::DHCP_ACK, reply_type(msg, reply->len));
+    return msgs;
+}
+
+TEST(server, rapid_commit) {
+    server_config cfg = TEST_CONFIG;
+    cfg.rapid_commit = true;
+
+    dhcp_server<2> srv(cfg);
+    dhcp_message msg;
+
+    {
+        const auto reply = srv.handle_dhcp_message(msg, rapid_commit(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 1)), 0);
+        ASSERT_EQ(true, reply.has_value());
+        ASSERT_EQ(dhcp_message_type::DHCP_ACK, reply_type(msg, reply->len));
+        ASSERT_EQ(ip4(10, 0, 0, 10), get_opt_val<u32>((const u8*)&msg.yiaddr));
+
+        const usize opt_len = reply->len - offsetof(dhcp_message, options);
+        ASSERT_EQ(true, get_option(msg.options, opt_len, dhcp_option::RAPID_COMMIT).has_value());
+        const auto lease_time = get_option(msg.options, opt_len, dhcp_option::IP_ADDRESS_LEASE_TIME);
+        ASSERT_EQ(TEST_POOL.lease_time_secs, get_opt_val<u32>(lease_time->data));
+    }
+
+    // Lease is committed with the full lease time, not only reserved.
+    srv.flush_expired(100);
+    ASSERT_EQ(1, srv.leases().active_leases());
+
+    // Clients without rapid commit still get the four message exchange.
+    {
+        const auto reply = srv.handle_dhcp_message(msg, make_request(msg, dhcp_message_type::DHCP_DISCOVER, 2), 0);
+        ASSERT_EQ(true, reply.has_value());
+        ASSERT_EQ(dhcp_message_type::DHCP_OFFER, reply_type(msg, reply->len));
+        ASSERT_EQ(false, get_option(msg.options, reply->len - offsetof(dhcp_message, options), dhcp_option::RAPID_COMMIT).has_value());
+    }
+}
+
+TEST(server, rapid_commit_join_latency) {
+    dhcp_message msg;
+
+    // Disabled: the option is ignored and the client needs the four message
+    // exchange.
+    dhcp_server<2> srv(TEST_CONFIG);
+    ASSERT_EQ(4, join(srv, msg, 1));
+
+    // Enabled: the client is configured after two messages, one round trip.
+    server_config cfg = TEST_CONFIG;
+    cfg.rapid_commit = true;
+    dhcp_server<2> rapid_srv(cfg);
+    ASSERT_EQ(2, join(rapid_srv, msg, 1));
+}
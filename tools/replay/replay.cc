@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+//
+// Replay dhcp traffic from a pcap file through the dhcp server engine.
+//
+// Requests (BOOTREQUEST from or to udp port 67) are fed into
+// 'handle_dhcp_message', using the pcap timestamps as clock. Recorded replies
+// (BOOTREPLY) are compared against the replies produced by the engine (matched
+// by xid). Relayed requests and replies both use port 67 on either side.
+
+#include <config.h>
+#include <dhcp.h>
+#include <pcap.h>
+#include <server.h>
+#include <utils.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+// Leases per pool, same as the embedded target (see src/main.cc).
+static constexpr usize LEASES = 16;
+
+struct reply {
+    u32 xid;
+    std::vector<u8> data;
+};
+
+// Map a byte offset in the dhcp message to the field name.
+static const char* field_name(usize off) {
+    static const struct {
+        usize off;
+        const char* name;
+    } fields[] = {
+        {offsetof(dhcp_message, op), "op"},         {offsetof(dhcp_message, htype), "htype"},
+        {offsetof(dhcp_message, hlen), "hlen"},     {offsetof(dhcp_message, hops), "hops"},
+        {offsetof(dhcp_message, xid), "xid"},       {offsetof(dhcp_message, secs), "secs"},
+        {offsetof(dhcp_message, flags), "flags"},   {offsetof(dhcp_message, ciaddr), "ciaddr"},
+        {offsetof(dhcp_message, yiaddr), "yiaddr"}, {offsetof(dhcp_message, siaddr), "siaddr"},
+        {offsetof(dhcp_message, giaddr), "giaddr"}, {offsetof(dhcp_message, chaddr), "chaddr"},
+        {offsetof(dhcp_message, sname), "sname"},   {offsetof(dhcp_message, file), "file"},
+        {offsetof(dhcp_message, cookie), "cookie"}, {offsetof(dhcp_message, options), "options"},
+    };
+
+    const char* name = "?";
+    for (const auto& f : fields) {
+        if (off >= f.off) {
+            name = f.name;
+        }
+    }
+    return name;
+}
+
+static std::vector<u8> read_file(const char* path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        std::fprintf(stderr, "Failed to open %s\n", path);
+        std::exit(1);
+    }
+    return std::vector<u8>((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+}
+
+static void usage(const char* prog) {
+    std::fprintf(stderr, "Usage: %s [-o] [-c <dhcp.conf>] <file.pcap>\n", prog);
+    std::fprintf(stderr, "  -o  replay at original speed (default: maximum speed)\n");
+    std::fprintf(stderr, "  -c  server configuration file (default: target defaults)\n");
+}
+
+int main(int argc, char* argv[]) {
+    bool original_speed = false;
+    const char* path = nullptr;
+    const char* config_path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-o") == 0) {
+            original_speed = true;
+        } else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            config_path = argv[++i];
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    server_config config = default_config();
+    if (config_path) {
+        const auto text = read_file(config_path);
+        usize err_line = 0;
+        const auto cfg = parse_config((const char*)text.data(), text.size(), config, &err_line);
+        if (!cfg) {
+            std::fprintf(stderr, "Malformed config %s at line %zu\n", config_path, err_line);
+            return 1;
+        }
+        config = cfg.value();
+    }
+
+    if (const auto pool = find_invalid_pool(config, LEASES)) {
+        std::fprintf(stderr, "Invalid lease range of pool %zu for %zu leases\n", pool.value(), LEASES);
+        return 1;
+    }
+
+    dhcp_server<LEASES> server(config);
+
+    const std::vector<u8> file = read_file(path);
+
+    pcap_reader rd(file.data(), file.size());
+    if (!rd.init()) {
+        std::fprintf(stderr, "Unsupported pcap file %s\n", path);
+        return 1;
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    usize requests = 0, replies = 0, matched = 0, differ = 0, missing = 0;
+    clock::duration engine_time{0};
+    std::deque<reply> pending;
+
+    std::optional<u64> first_ts;
+    usize last_flush = 0;
+    const auto wall_start = clock::now();
+
+    while (const auto pkt = rd.next()) {
+        if (!first_ts) {
+            first_ts = pkt->ts_usec;
+        }
+
+        const auto op = pcap_dhcp_op(pkt.value());
+        if (op == dhcp_operation::BOOTREQUEST) {
+            if (pkt->len > sizeof(dhcp_message)) {
+                continue;
+            }
+
+            if (original_speed) {
+                std::this_thread::sleep_until(wall_start + std::chrono::microseconds(pkt->ts_usec - first_ts.value()));
+            }
+
+            dhcp_message msg;
+            std::memset(&msg, 0, sizeof(msg));
+            std::memcpy(&msg, pkt->payload, pkt->len);
+
+            // Emulate the periodic maintenance of the target between packets.
+            const usize now_secs = pkt->ts_usec / 1000000;
+            if (now_secs != last_flush) {
+                server.flush_expired(now_secs);
+                last_flush = now_secs;
+            }
+
+            ++requests;
+            const auto start = clock::now();
+            const auto r = server.handle_dhcp_message(msg, pkt->len, now_secs);
+            engine_time += clock::now() - start;
+
+            if (r) {
+                ++replies;
+                const u8* data = reinterpret_cast<const u8*>(&msg);
+                pending.push_back({msg.xid, std::vector<u8>(data, data + r->len)});
+            }
+        } else if (op == dhcp_operation::BOOTREPLY) {
+            dhcp_message rec;
+            std::memset(&rec, 0, sizeof(rec));
+            std::memcpy(&rec, pkt->payload, pkt->len > sizeof(rec) ? sizeof(rec) : pkt->len);
+
+            auto it = pending.begin();
+            while (it != pending.end() && it->xid != rec.xid) {
+                ++it;
+            }
+
+            if (it == pending.end()) {
+                ++missing;
+                std::printf("xid=%08x: recorded reply not produced\n", rec.xid);
+                continue;
+            }
+
+            const usize len = it->data.size() < pkt->len ? it->data.size() : pkt->len;
+            usize off = 0;
+            while (off < len && it->data[off] == pkt->payload[off]) {
+                ++off;
+            }
+
+            if (off == len && it->data.size() == pkt->len) {
+                ++matched;
+            } else {
+                ++differ;
+                std::printf("xid=%08x: reply differs at offset %zu (%s), len %zu recorded %zu\n", rec.xid, off, field_name(off),
+                            it->data.size(), pkt->len);
+            }
+            pending.erase(it);
+        }
+    }
+
+    const double wall_secs = std::chrono::duration<double>(clock::now() - wall_start).count();
+    const double engine_secs = std::chrono::duration<double>(engine_time).count();
+
+    std::printf("requests       : %zu\n", requests);
+    std::printf("replies        : %zu\n", replies);
+    std::printf("  matched      : %zu\n", matched);
+    std::printf("  differ       : %zu\n", differ);
+    std::printf("  not recorded : %zu\n", pending.size());
+    std::printf("  not produced : %zu\n", missing);
+    std::printf("wall time      : %.3f s\n", wall_secs);
+    if (requests > 0 && engine_secs > 0) {
+        std::printf("engine         : %.0f req/s (%.0f ns/req)\n", requests / engine_secs, engine_secs * 1e9 / requests);
+    }
+
+    return differ || missing || !pending.empty() ? 2 : 0;
+}
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+//
+// Socket io backends driving the dhcp server engine on a linux host.
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <dhcp.h>
+#include <server.h>
+#include <types.h>
+
+#include <atomic>
+#include <optional>
+
+// Handle the received message 'msg' of length 'len', the reply is crafted
+// in-place in 'msg' (see 'dhcp_server::handle_dhcp_message').
+using backend_handler = std::optional<dhcp_reply> (*)(void* ctx, dhcp_message& msg, usize len);
+
+// Maintenance hook, run after each batch of messages and at least every
+// 100ms while idle.
+using backend_tick = void (*)(void* ctx);
+
+struct backend_config {
+    // Bound udp socket.
+    int fd;
+    // Send replies to the source of the request instead of the reply
+    // destination chosen by the engine (for benchmarks over loopback).
+    bool reply_to_sender;
+
+    backend_handler handler;
+    backend_tick tick;
+    void* ctx;
+
+    // Backends return shortly after 'stop' is set.
+    const std::atomic<bool>* stop;
+};
+
+struct backend_stats {
+    u64 requests;
+    u64 replies;
+    // Number of syscalls issued by the backend.
+    u64 syscalls;
+};
+
+// Serve requests with non blocking sockets and epoll, one syscall per
+// received and sent message plus one per wakeup.
+//
+// Return false on socket errors.
+bool run_epoll(const backend_config& cfg, backend_stats& stats);
+
+// Serve requests with io_uring: a multishot recvmsg fills buffers from a
+// registered provided-buffer ring and replies are submitted as linked sends,
+// such that a single io_uring_enter submits all replies of a batch and waits
+// for the next one.
+//
+// Return false if io_uring or one of the required features is not available,
+// in that case nothing was received and the caller can fall back to
+// 'run_epoll'. Errors once serving are fatal.
+bool run_uring(const backend_config& cfg, backend_stats& stats);
+
+#endif
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+
+#include "backend.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Timeout to check the stop flag and run the maintenance hook while idle.
+static constexpr int WAIT_TIMEOUT_MS = 100;
+
+bool run_epoll(const backend_config& cfg, backend_stats& stats) {
+    const int ep = epoll_create1(0);
+    if (ep < 0) {
+        std::perror("epoll_create1");
+        return false;
+    }
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = cfg.fd;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, cfg.fd, &ev) != 0) {
+        std::perror("epoll_ctl");
+        close(ep);
+        return false;
+    }
+
+    dhcp_message msg;
+    bool ok = true;
+
+    while (ok && !cfg.stop->load()) {
+        ++stats.syscalls;
+        const int n = epoll_wait(ep, &ev, 1, WAIT_TIMEOUT_MS);
+        if (n < 0 && errno != EINTR) {
+            std::perror("epoll_wait");
+            ok = false;
+        }
+        if (n <= 0) {
+            cfg.tick(cfg.ctx);
+            continue;
+        }
+
+        // Drain the socket, the last read fails with EAGAIN.
+        for (;;) {
+            sockaddr_in src;
+            socklen_t src_len = sizeof(src);
+
+            ++stats.syscalls;
+            const ssize_t len = recvfrom(cfg.fd, &msg, sizeof(msg), MSG_DONTWAIT | MSG_TRUNC, (sockaddr*)&src, &src_len);
+            if (len < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    std::perror("recvfrom");
+                    ok = false;
+                }
+                break;
+            }
+
+            // Drop truncated messages.
+            if (static_cast<usize>(len) > sizeof(msg)) {
+                continue;
+            }
+
+            ++stats.requests;
+            const auto reply = cfg.handler(cfg.ctx, msg, len);
+            if (!reply) {
+                continue;
+            }
+
+            sockaddr_in dst = src;
+            if (!cfg.reply_to_sender) {
+                dst.sin_addr.s_addr = htonl(reply->dst);
+                dst.sin_port = htons(reply->port);
+            }
+
+            // Replies are best effort, like on the target.
+            ++stats.syscalls;
+            if (sendto(cfg.fd, &msg, reply->len, 0, (const sockaddr*)&dst, sizeof(dst)) == static_cast<ssize_t>(reply->len)) {
+                ++stats.replies;
+            }
+        }
+
+        cfg.tick(cfg.ctx);
+    }
+
+    close(ep);
+    return ok;
+}
@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+//
+// Run the dhcp server engine on a linux host.
+//
+// Requests are served with the io_uring backend, or the epoll backend if
+// io_uring is not available (or requested with '-b epoll').
+//
+// With '-q <path>' the server snapshot (counters and leases) can be queried
+// on a unix stream socket, eg with 'nc -U <path>'. The snapshot is published
+// once per second through a seqlock, queries never stall packet handling.
+//
+// If 'ddns_server' is set in the configuration, lease events are coalesced
+// into dynamic dns updates (rfc2136) sent once per second at most.
+//
+// In benchmark mode ('-B') a load generator drives every backend over
+// loopback and reports requests per second, server cpu time and syscalls per
+// request.
+
+#include "backend.h"
+
+#include <config.h>
+#include <ddns.h>
+#include <dhcp.h>
+#include <lease_events.h>
+#include <query.h>
+#include <seqlock.h>
+#include <server.h>
+#include <utils.h>
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <netinet/in.h>
+#include <poll.h>
+#include <random>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Number of leases per pool.
+static constexpr usize LEASES = 200;
+
+// Number of lease events queued between two maintenance ticks, and number of
+// addresses whose dns record is tracked.
+static constexpr usize EVENT_SLOTS = 1024;
+static constexpr usize DDNS_SLOTS = 1024;
+
+static std::atomic<bool> STOP{false};
+
+using server_t = dhcp_server<LEASES>;
+
+using snapshot_t = server_snapshot<LEASES>;
+
+using ddns_t = ddns_batcher<DDNS_SLOTS>;
+
+struct server_ctx {
+    server_t* server;
+    usize last_tick;
+    // Published by the backend thread, read by the query thread.
+    seqlock<snapshot_t>* snapshot;
+    // Dynamic dns updates, sent on 'ddns_fd'.
+    ddns_t* ddns;
+    int ddns_fd;
+};
+
+// Written by the server while handling messages, drained by the maintenance
+// tick.
+static event_ring<EVENT_SLOTS> EVENTS;
+
+static void queue_event(const lease_event& ev) {
+    EVENTS.push(ev);
+}
+
+static usize now_secs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+static double thread_cpu_secs() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::optional<dhcp_reply> handle(void* ctx, dhcp_message& msg, usize len) {
+    server_ctx& c = *static_cast<server_ctx*>(ctx);
+    return c.server->handle_dhcp_message(msg, len, now_secs());
+}
+
+// Periodic maintenance once per second, like the scheduler on the target.
+static void tick(void* ctx) {
+    server_ctx& c = *static_cast<server_ctx*>(ctx);
+
+    const usize now = now_secs();
+    if (now == c.last_tick) {
+        return;
+    }
+    c.last_tick = now;
+
+    c.server->flush_expired(now);
+    if (c.snapshot) {
+        c.snapshot->write([&](snapshot_t& snap) { c.server->snapshot(snap, now); });
+    }
+
+    if (c.ddns) {
+        const ddns_config cfg = c.server->config().ddns;
+        c.ddns->drain(EVENTS, cfg, now, [&](const u8* msg, usize len) {
+            sockaddr_in dst = {};
+            dst.sin_family = AF_INET;
+            dst.sin_addr.s_addr = htonl(cfg.server);
+            dst.sin_port = htons(cfg.port);
+            // Updates are best effort.
+            sendto(c.ddns_fd, msg, len, 0, (const sockaddr*)&dst, sizeof(dst));
+        });
+    }
+}
+
+// Serve snapshot queries on the unix stream socket 'path' until 'STOP' is set,
+// each connection gets the last published snapshot as text.
+static void serve_queries(const char* path, const seqlock<snapshot_t>& snapshot) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un sa = {};
+    sa.sun_family = AF_UNIX;
+    std::snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", path);
+    unlink(path);
+    if (fd < 0 || bind(fd, (const sockaddr*)&sa, sizeof(sa)) != 0 || listen(fd, 4) != 0) {
+        std::perror("query socket");
+        std::exit(1);
+    }
+
+    auto snap = std::make_unique<snapshot_t>();
+    while (!STOP.load()) {
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100 /* ms */) <= 0) {
+            continue;
+        }
+
+        const int conn = accept(fd, nullptr, nullptr);
+        if (conn < 0) {
+            continue;
+        }
+
+        snapshot.read(*snap);
+        format_snapshot(*snap, [&](const char* str, usize len) {
+            if (write(conn, str, len) < 0) {
+                // Client went away, remaining lines are dropped.
+            }
+        });
+        close(conn);
+    }
+
+    close(fd);
+    unlink(path);
+}
+
+static void log_server(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    std::vprintf(fmt, ap);
+    va_end(ap);
+}
+
+static void on_signal(int) {
+    STOP.store(true);
+}
+
+static std::vector<u8> read_file(const char* path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        std::fprintf(stderr, "Failed to open %s\n", path);
+        std::exit(1);
+    }
+    return std::vector<u8>((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+}
+
+// Open an udp socket bound to 'addr':'port'.
+static int open_socket(u32 addr, u16 port) {
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        std::perror("socket");
+        std::exit(1);
+    }
+
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+
+    sockaddr_in sa = {};
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(addr);
+    sa.sin_port = htons(port);
+    if (bind(fd, (const sockaddr*)&sa, sizeof(sa)) != 0) {
+        std::perror("bind");
+        std::exit(1);
+    }
+    return fd;
+}
+
+// Run the backend 'name', fall back to epoll if io_uring is not available.
+static bool run_backend(const char* name, const backend_config& cfg, backend_stats& stats) {
+    if (std::strcmp(name, "uring") == 0) {
+        if (run_uring(cfg, stats)) {
+            return true;
+        }
+        std::fprintf(stderr, "io_uring not available, falling back to epoll\n");
+    }
+    return run_epoll(cfg, stats);
+}
+
+// -- Benchmark.
+
+// Number of distinct clients of the load generator.
+static constexpr usize BENCH_CLIENTS = 64;
+// Number of requests in flight.
+static constexpr usize BENCH_WINDOW = 32;
+
+// Build a client request of type 'type' for client 'id' to server 'server_id'.
+static usize make_request(dhcp_message& msg, dhcp_message_type type, u32 id, u32 xid, u32 server_id) {
+    std::memset(&msg, 0, sizeof(msg));
+    msg.op = dhcp_operation::BOOTREQUEST;
+    msg.htype = 1;
+    msg.hlen = 6;
+    msg.xid = xid;
+    put_opt_val(&msg.chaddr[2], id);
+    msg.cookie = DHCP_OPTION_COOKIE;
+
+    u8* optp = msg.options;
+    *optp++ = into_raw(dhcp_option::DHCP_MESSAGE_TYPE);
+    *optp++ = 1;
+    *optp++ = into_raw(type);
+
+    if (type == dhcp_message_type::DHCP_REQUEST) {
+        *optp++ = into_raw(dhcp_option::SERVER_IDENTIFIER);
+        *optp++ = 4;
+        optp = put_opt_val(optp, server_id);
+    }
+
+    *optp++ = into_raw(dhcp_option::END);
+    return optp - (u8*)&msg;
+}
+
+// Drive 'backend' over loopback with 'requests' requests.
+static void bench_backend(const char* backend, const server_config& config, usize requests) {
+    const int fd = open_socket(ip4(127, 0, 0, 1), 0);
+    sockaddr_in server_addr;
+    socklen_t server_addr_len = sizeof(server_addr);
+    getsockname(fd, (sockaddr*)&server_addr, &server_addr_len);
+
+    auto server = std::make_unique<server_t>(config);
+    server_ctx ctx = {server.get(), 0, nullptr, nullptr, -1};
+    std::atomic<bool> stop{false};
+    backend_stats stats = {};
+    double cpu_secs = 0;
+
+    std::thread thread([&]() {
+        const backend_config cfg = {fd, true /* reply_to_sender */, handle, tick, &ctx, &stop};
+        const double start = thread_cpu_secs();
+        run_backend(backend, cfg, stats);
+        cpu_secs = thread_cpu_secs() - start;
+    });
+
+    const int client = socket(AF_INET, SOCK_DGRAM, 0);
+    const timeval timeout = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    connect(client, (const sockaddr*)&server_addr, sizeof(server_addr));
+
+    dhcp_message msg;
+    usize sent = 0, received = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    while (sent < requests) {
+        const usize burst = requests - sent < BENCH_WINDOW ? requests - sent : BENCH_WINDOW;
+
+        // Each client sends a DISCOVER followed by a REQUEST.
+        for (usize i = 0; i < burst; ++i, ++sent) {
+            const auto type = sent % 2 ? dhcp_message_type::DHCP_REQUEST : dhcp_message_type::DHCP_DISCOVER;
+            const usize len = make_request(msg, type, sent / 2 % BENCH_CLIENTS + 1, sent, config.local_ip);
+            send(client, &msg, len, 0);
+        }
+        for (usize i = 0; i < burst; ++i) {
+            if (recv(client, &msg, sizeof(msg), 0) < 0) {
+                break;
+            }
+            ++received;
+        }
+    }
+    const double wall_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    stop.store(true);
+    thread.join();
+    close(client);
+    close(fd);
+
+    std::printf("%-5s: %.0f req/s, %.2f us cpu/req, %.2f syscalls/req (%zu requests, %zu replies)\n", backend, received / wall_secs,
+                cpu_secs * 1e6 / stats.requests, double(stats.syscalls) / stats.requests, sent, received);
+}
+
+// -- Main.
+
+static void usage(const char* prog) {
+    std::fprintf(stderr, "Usage: %s [-b epoll|uring] [-p <port>] [-c <dhcp.conf>] [-q <socket>] [-v] [-B <requests>]\n", prog);
+    std::fprintf(stderr, "  -b  io backend (default: uring, falls back to epoll)\n");
+    std::fprintf(stderr, "  -p  server port (default: %d)\n", DHCP_SERVER_PORT);
+    std::fprintf(stderr, "  -c  server configuration file (default: target defaults)\n");
+    std::fprintf(stderr, "  -q  serve snapshot queries on unix socket\n");
+    std::fprintf(stderr, "  -v  log handled messages\n");
+    std::fprintf(stderr, "  -B  benchmark all backends over loopback\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* backend = "uring";
+    const char* config_path = nullptr;
+    const char* query_path = nullptr;
+    u16 port = DHCP_SERVER_PORT;
+    bool verbose = false;
+    usize bench_requests = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            backend = argv[++i];
+            if (std::strcmp(backend, "epoll") != 0 && std::strcmp(backend, "uring") != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            config_path = argv[++i];
+        } else if (std::strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            query_path = argv[++i];
+        } else if (std::strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (std::strcmp(argv[i], "-B") == 0 && i + 1 < argc) {
+            bench_requests = std::strtoul(argv[++i], nullptr, 0);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    server_config config = default_config();
+    if (config_path) {
+        const auto text = read_file(config_path);
+        usize err_line = 0;
+        const auto cfg = parse_config((const char*)text.data(), text.size(), config, &err_line);
+        if (!cfg) {
+            std::fprintf(stderr, "Malformed config %s at line %zu\n", config_path, err_line);
+            return 1;
+        }
+        config = cfg.value();
+    }
+
+    if (const auto pool = find_invalid_pool(config, LEASES)) {
+        std::fprintf(stderr, "Invalid lease range of pool %zu for %zu leases\n", pool.value(), LEASES);
+        return 1;
+    }
+
+    if (bench_requests) {
+        bench_backend("epoll", config, bench_requests);
+        bench_backend("uring", config, bench_requests);
+        return 0;
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    std::random_device rd;
+    auto server = std::make_unique<server_t>(config, verbose ? log_server : nullptr, (u64(rd()) << 32) | rd(), queue_event);
+    auto snapshot = std::make_unique<seqlock<snapshot_t>>();
+    auto ddns = std::make_unique<ddns_t>();
+    const int ddns_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    server_ctx ctx = {server.get(), 0, snapshot.get(), ddns.get(), ddns_fd};
+
+    std::thread query;
+    if (query_path) {
+        query = std::thread(serve_queries, query_path, std::cref(*snapshot));
+    }
+
+    const int fd = open_socket(0 /* INADDR_ANY */, port);
+    const backend_config cfg = {fd, false /* reply_to_sender */, handle, tick, &ctx, &STOP};
+    backend_stats stats = {};
+
+    const bool ok = run_backend(backend, cfg, stats);
+    close(fd);
+    close(ddns_fd);
+
+    STOP.store(true);
+    if (query.joinable()) {
+        query.join();
+    }
+
+    std::printf("requests : %llu\n", (unsigned long long)stats.requests);
+    std::printf("replies  : %llu\n", (unsigned long long)stats.replies);
+    std::printf("syscalls : %llu\n", (unsigned long long)stats.syscalls);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,403 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2022, Johannes Stoelp <dev@memzero.de>
+//
+// io_uring backend using the raw syscall interface, no liburing required.
+
+#include "backend.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+// Number of submission queue entries.
+static constexpr u32 RING_ENTRIES = 256;
+// Number of provided receive buffers (power of two).
+static constexpr u32 RECV_BUFS = 256;
+// Number of replies in flight.
+static constexpr u32 SEND_SLOTS = 2 * RECV_BUFS;
+// Provided buffer group of the receive buffers.
+static constexpr u16 RECV_GROUP = 0;
+
+// Timeout to check the stop flag and run the maintenance hook while idle.
+static constexpr long WAIT_TIMEOUT_NS = 100 * 1000 * 1000;
+
+// Multishot recvmsg layout of a provided buffer: header, source address, message.
+static constexpr usize RECV_BUF_SIZE = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + sizeof(dhcp_message);
+
+// Tag of the completions of the multishot recvmsg, sends carry their slot.
+static constexpr u64 RECV_TAG = ~0ull;
+
+static int sys_io_uring_setup(u32 entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, u32 submit, u32 wait, u32 flags, const void* arg, usize argsz) {
+    return syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, u32 op, void* arg, u32 nargs) {
+    return syscall(__NR_io_uring_register, fd, op, arg, nargs);
+}
+
+namespace {
+    // Reply in flight, owned by the kernel until its send completes.
+    struct send_slot {
+        dhcp_message msg;
+        sockaddr_in dst;
+        iovec iov;
+        msghdr hdr;
+    };
+
+    // Mapped io_uring instance with a provided-buffer ring for receives.
+    class uring {
+      public:
+        uring() = default;
+        uring(const uring&) = delete;
+        uring& operator=(const uring&) = delete;
+
+        ~uring() {
+            if (ring_fd >= 0) {
+                close(ring_fd);
+            }
+            unmap(sq_ptr, sq_len);
+            if (cq_ptr != sq_ptr) {
+                unmap(cq_ptr, cq_len);
+            }
+            unmap(sqes, sqes_len);
+            unmap(buf_ring, buf_ring_len);
+            unmap(bufs, bufs_len);
+        }
+
+        // Create the ring and register the receive buffers.
+        bool setup() {
+            io_uring_params p;
+
+            // Completions are only reaped by this thread, defer the task work
+            // to the next wait instead of interrupting the receive path.
+            std::memset(&p, 0, sizeof(p));
+            p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+            ring_fd = sys_io_uring_setup(RING_ENTRIES, &p);
+            if (ring_fd < 0 && errno == EINVAL) {
+                std::memset(&p, 0, sizeof(p));
+                ring_fd = sys_io_uring_setup(RING_ENTRIES, &p);
+            }
+            if (ring_fd < 0) {
+                return false;
+            }
+            if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+                return false;
+            }
+
+            sq_len = p.sq_off.array + p.sq_entries * sizeof(u32);
+            cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            sq_len = cq_len = sq_len > cq_len ? sq_len : cq_len;
+            sq_ptr = cq_ptr = map(ring_fd, IORING_OFF_SQ_RING, sq_len);
+            sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+            sqes = static_cast<io_uring_sqe*>(map(ring_fd, IORING_OFF_SQES, sqes_len));
+            if (!sq_ptr || !sqes) {
+                return false;
+            }
+
+            u8* sq = static_cast<u8*>(sq_ptr);
+            sq_head = reinterpret_cast<u32*>(sq + p.sq_off.head);
+            sq_tail = reinterpret_cast<u32*>(sq + p.sq_off.tail);
+            sq_mask = *reinterpret_cast<u32*>(sq + p.sq_off.ring_mask);
+            sq_array = reinterpret_cast<u32*>(sq + p.sq_off.array);
+            sq_entries = p.sq_entries;
+            local_tail = *sq_tail;
+
+            u8* cq = static_cast<u8*>(cq_ptr);
+            cq_head = reinterpret_cast<u32*>(cq + p.cq_off.head);
+            cq_tail = reinterpret_cast<u32*>(cq + p.cq_off.tail);
+            cq_mask = *reinterpret_cast<u32*>(cq + p.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+            // Provided-buffer ring, must be page aligned.
+            buf_ring_len = RECV_BUFS * sizeof(io_uring_buf);
+            buf_ring = static_cast<io_uring_buf_ring*>(map(-1, 0, buf_ring_len));
+            bufs_len = RECV_BUFS * RECV_BUF_SIZE;
+            bufs = static_cast<u8*>(map(-1, 0, bufs_len));
+            if (!buf_ring || !bufs) {
+                return false;
+            }
+
+            io_uring_buf_reg reg;
+            std::memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = reinterpret_cast<u64>(buf_ring);
+            reg.ring_entries = RECV_BUFS;
+            reg.bgid = RECV_GROUP;
+            if (sys_io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+                return false;
+            }
+
+            for (u16 bid = 0; bid < RECV_BUFS; ++bid) {
+                recycle(bid);
+            }
+            publish_bufs();
+            return true;
+        }
+
+        // Check if the submission queue is full, pending entries must be
+        // submitted before getting new ones.
+        bool sq_full() const {
+            return local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries;
+        }
+
+        // Get the next free submission entry, the queue must not be full.
+        io_uring_sqe* get_sqe() {
+            io_uring_sqe* sqe = &sqes[local_tail & sq_mask];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sq_array[local_tail & sq_mask] = local_tail & sq_mask;
+            ++local_tail;
+            __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+            return sqe;
+        }
+
+        // Submit pending entries and wait for a completion or the timeout
+        // 'timeout_ns'.
+        int enter(long timeout_ns) {
+            const u32 pending = local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+            __kernel_timespec ts = {0, timeout_ns};
+            io_uring_getevents_arg arg;
+            std::memset(&arg, 0, sizeof(arg));
+            arg.ts = reinterpret_cast<u64>(&ts);
+
+            return sys_io_uring_enter(ring_fd, pending, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        }
+
+        // Get the next completion, nullptr if there is none.
+        io_uring_cqe* peek_cqe() {
+            const u32 head = *cq_head;
+            if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                return nullptr;
+            }
+            return &cqes[head & cq_mask];
+        }
+
+        void advance_cq() {
+            __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+        }
+
+        // Get the provided receive buffer 'bid'.
+        u8* buf(u16 bid) {
+            return bufs + bid * RECV_BUF_SIZE;
+        }
+
+        // Hand the receive buffer 'bid' back to the kernel, visible after
+        // 'publish_bufs'.
+        void recycle(u16 bid) {
+            // Index the entries manually, with C++ the flexible array member
+            // of 'io_uring_buf_ring' is not at offset 0.
+            io_uring_buf& b = reinterpret_cast<io_uring_buf*>(buf_ring)[buf_tail & (RECV_BUFS - 1)];
+            b.addr = reinterpret_cast<u64>(buf(bid));
+            b.len = RECV_BUF_SIZE;
+            b.bid = bid;
+            ++buf_tail;
+        }
+
+        void publish_bufs() {
+            __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+        }
+
+      private:
+        static void* map(int fd, off_t off, usize len) {
+            const int flags = fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED | MAP_POPULATE;
+            void* ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE, flags, fd, off);
+            return ptr == MAP_FAILED ? nullptr : ptr;
+        }
+
+        static void unmap(void* ptr, usize len) {
+            if (ptr) {
+                munmap(ptr, len);
+            }
+        }
+
+        int ring_fd = -1;
+
+        void* sq_ptr = nullptr;
+        usize sq_len = 0;
+        u32* sq_head = nullptr;
+        u32* sq_tail = nullptr;
+        u32* sq_array = nullptr;
+        u32 sq_mask = 0;
+        u32 sq_entries = 0;
+        u32 local_tail = 0;
+
+        io_uring_sqe* sqes = nullptr;
+        usize sqes_len = 0;
+
+        void* cq_ptr = nullptr;
+        usize cq_len = 0;
+        u32* cq_head = nullptr;
+        u32* cq_tail = nullptr;
+        u32 cq_mask = 0;
+        io_uring_cqe* cqes = nullptr;
+
+        io_uring_buf_ring* buf_ring = nullptr;
+        usize buf_ring_len = 0;
+        u8* bufs = nullptr;
+        usize bufs_len = 0;
+        u16 buf_tail = 0;
+    };
+}  // namespace
+
+[[noreturn]] static void fatal(const char* what, int err) {
+    std::fprintf(stderr, "%s: %s\n", what, std::strerror(err));
+    std::exit(1);
+}
+
+bool run_uring(const backend_config& cfg, backend_stats& stats) {
+    uring ring;
+    if (!ring.setup()) {
+        return false;
+    }
+
+    // Template for the multishot recvmsg, the kernel only looks at the
+    // address and control lengths to lay out the provided buffers.
+    msghdr recv_hdr;
+    std::memset(&recv_hdr, 0, sizeof(recv_hdr));
+    recv_hdr.msg_namelen = sizeof(sockaddr_in);
+
+    const auto arm_recv = [&]() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = cfg.fd;
+        sqe->addr = reinterpret_cast<u64>(&recv_hdr);
+        sqe->len = 1;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = RECV_GROUP;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->user_data = RECV_TAG;
+    };
+
+    std::vector<send_slot> slots(SEND_SLOTS);
+    std::vector<u32> free_slots(SEND_SLOTS);
+    usize nfree = SEND_SLOTS;
+    for (u32 s = 0; s < SEND_SLOTS; ++s) {
+        free_slots[s] = s;
+    }
+
+    bool armed = false;
+    bool served = false;
+
+    while (!cfg.stop->load()) {
+        if (!armed && !ring.sq_full()) {
+            arm_recv();
+            armed = true;
+        }
+
+        ++stats.syscalls;
+        if (ring.enter(WAIT_TIMEOUT_NS) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            fatal("io_uring_enter", errno);
+        }
+
+        // Last send of this batch, ends the link chain.
+        io_uring_sqe* last_send = nullptr;
+
+        // Completions left when the submission queue fills up are handled
+        // after the next submission.
+        io_uring_cqe* cqe;
+        while (!ring.sq_full() && (cqe = ring.peek_cqe())) {
+            const u64 tag = cqe->user_data;
+            const int res = cqe->res;
+            const u32 flags = cqe->flags;
+            ring.advance_cq();
+
+            if (tag != RECV_TAG) {
+                // Send completed, replies are best effort like on the target.
+                if (res > 0) {
+                    ++stats.replies;
+                }
+                free_slots[nfree++] = static_cast<u32>(tag);
+                continue;
+            }
+
+            if (!(flags & IORING_CQE_F_MORE)) {
+                armed = false;
+            }
+
+            if (res < 0) {
+                // Out of buffers, re-armed once buffers are recycled.
+                if (res == -ENOBUFS) {
+                    continue;
+                }
+                // Multishot recvmsg or provided-buffer rings not supported by
+                // this kernel.
+                if (!served && res == -EINVAL) {
+                    return false;
+                }
+                fatal("recvmsg", -res);
+            }
+            served = true;
+
+            const u16 bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            const u8* buf = ring.buf(bid);
+            const auto* out = reinterpret_cast<const io_uring_recvmsg_out*>(buf);
+            const u8* name = buf + sizeof(io_uring_recvmsg_out);
+            const u8* payload = name + recv_hdr.msg_namelen + recv_hdr.msg_controllen;
+
+            // Drop truncated messages and replies without free slot.
+            if ((out->flags & MSG_TRUNC) || nfree == 0) {
+                ring.recycle(bid);
+                continue;
+            }
+
+            const u32 s = free_slots[--nfree];
+            send_slot& slot = slots[s];
+            std::memcpy(&slot.msg, payload, out->payloadlen);
+            std::memcpy(&slot.dst, name, sizeof(slot.dst));
+            ring.recycle(bid);
+
+            ++stats.requests;
+            const auto reply = cfg.handler(cfg.ctx, slot.msg, out->payloadlen);
+            if (!reply) {
+                free_slots[nfree++] = s;
+                continue;
+            }
+
+            if (!cfg.reply_to_sender) {
+                slot.dst.sin_family = AF_INET;
+                slot.dst.sin_addr.s_addr = htonl(reply->dst);
+                slot.dst.sin_port = htons(reply->port);
+            }
+            slot.iov = {&slot.msg, reply->len};
+            std::memset(&slot.hdr, 0, sizeof(slot.hdr));
+            slot.hdr.msg_name = &slot.dst;
+            slot.hdr.msg_namelen = sizeof(slot.dst);
+            slot.hdr.msg_iov = &slot.iov;
+            slot.hdr.msg_iovlen = 1;
+
+            // Link the sends of a batch, such that replies go out in order
+            // with a single submission. Hard links keep the chain going if a
+            // send fails.
+            io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = cfg.fd;
+            sqe->addr = reinterpret_cast<u64>(&slot.hdr);
+            sqe->len = 1;
+            sqe->flags = IOSQE_IO_HARDLINK;
+            sqe->user_data = s;
+            last_send = sqe;
+        }
+
+        if (last_send) {
+            last_send->flags &= ~IOSQE_IO_HARDLINK;
+        }
+
+        ring.publish_bufs();
+        cfg.tick(cfg.ctx);
+    }
+
+    return true;
+}